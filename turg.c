@@ -7,7 +7,22 @@
 #include <stddef.h>
 #include <getopt.h>
 #include <math.h>
+#include <sched.h>
 #include <termio.h>
+#include <termios.h>
+#if defined(linux)
+#include <linux/serial.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#endif
+#endif
 
 #include <poptIO.h>
 #include <rpmdefs.h>
@@ -22,6 +37,7 @@
 #define	TWIDDLE		'~'
 #define	_CMD_NDEVS	32
 #define	_URG_STRING_LEN	32
+#define	MSGBUFLEN	256
 
 /*==============================================================*/
 typedef	char		STRING_t[_URG_STRING_LEN];
@@ -100,6 +116,21 @@ static struct RANGE_s _temperature_celsius =
 static struct RANGE_s _barometer_torr =
 	{ _F2I( 225.), _F2I( 760.), _F2I( 825.), UNITS_TORR, };
 
+/*
+ * Online statistics, kept as exact integer sums: adding a sample is a
+ * multiply and adds, and the mean and M2 are divided out only when read.
+ * Partials (e.g. per window) merge by adding. The sum of squares is 128
+ * bits, so n * sumsq - sum^2 is exact and M2 cannot cancel.
+ */
+typedef struct STAT_s * STAT_t;
+struct STAT_s {
+    uint64_t	n;
+    FLOAT_t	min;
+    FLOAT_t	max;
+    int64_t	sum;		/* sum of x */
+    __int128	sumsq;		/* sum of x^2 */
+};
+
 typedef struct SENSOR_s * SENSOR_t;
 struct SENSOR_s {
     STRING_t	name;
@@ -118,6 +149,35 @@ struct SENSOR_s {
     TSTAMP_t	tstamp;
     FLOAT_t	sum;
     uint16_t	npts;
+    struct STAT_s stat;		/* avg, min, max, sum and npts derive from this */
+};
+
+/*
+ * The A2D sensors as a structure of arrays, one lane per sensor, so that
+ * a sweep of raw codes is scaled and accumulated in one call. The lanes
+ * keep sums shifted by their first sample, and are merged into each
+ * SENSOR_s stat when read or every _BANK_NFLUSH samples: a short window
+ * keeps the double s2 an exact integer.
+ */
+#define	_BANK_NLANES	8	/* FLOAT_t lanes in a 256-bit register */
+#define	_BANK_NFLUSH	64	/* samples per lane between merges */
+#define	_LUT_NCODES	4096	/* table entries per lane: 10/12-bit A2D codes */
+typedef struct BANK_s * BANK_t;
+struct BANK_s {
+    FLOAT_t	gain[_BANK_NLANES];
+    FLOAT_t	off[_BANK_NLANES];
+    FLOAT_t	k[_BANK_NLANES];	/* shift: the first sample */
+    FLOAT_t	min[_BANK_NLANES];
+    FLOAT_t	max[_BANK_NLANES];
+    uint64_t	n[_BANK_NLANES];
+    int64_t	s1[_BANK_NLANES];	/* sum of (x - k) */
+    double	s2[_BANK_NLANES];	/* sum of (x - k)^2 */
+    FLOAT_t	*lut;			/* _BANK_NLANES x _LUT_NCODES values */
+    uint32_t	lutmask;		/* lanes converted by lut[] */
+    uint16_t	raw[_BANK_NLANES];	/* codes staged for the next sweep */
+    uint32_t	pending;		/* lanes staged in raw[] */
+    uint32_t	seen;			/* lanes with samples (k is set) */
+    int		loaded;			/* gain/off copied from the sensors */
 };
 
 typedef struct FLAGS_s * FLAGS_t;
@@ -305,7 +365,11 @@ struct URG_s {
     FLOAT_t	temp;
     FLOAT_t	pres;
 
+    struct BANK_s bank;		/* A2D[0-7] scaling and accumulators */
 };
+#if _NSENSORS > _BANK_NLANES
+#error "struct BANK_s needs a lane per A2D sensor"
+#endif
 
 static struct URG_s _urg = {
     /* Site Log */
@@ -434,8 +498,6 @@ static struct URG_s _urg = {
     .pres			= _F2I(760.),
 };
 
-static URG_t urg = &_urg;
-
 /*==============================================================*/
 typedef enum CSVtype_e {
     CSVT_integer	= t_integer,
@@ -487,6 +549,32 @@ static char *CSVtypestr[] = {
 };
 #undef	_ENTRY
 
+/* A CSV field, typed, located at base + CSV_s.off in some instance. */
+typedef union CSVptr_u {
+	void *_ptr;
+
+        int *integer;
+        unsigned int *uinteger;
+        double *real;
+        char *string;
+        bool *boolean;
+        char *character;
+
+	int8_t *_i8p;
+	int16_t *_i16p;
+	int32_t *_i32p;
+	int64_t *_i64p;
+	uint8_t *_ui8p;
+	uint16_t *_ui16p;
+	uint32_t *_ui32p;
+	uint64_t *_ui64p;
+	float *_fp;
+	double *_dp;
+	TSTAMP_t *_tstamp;
+	TDIFF_t *_tdiff;
+	FLOAT_t *_float;
+} CSVptr_t;
+
 typedef struct CSV_s *CSV_t;
 struct CSV_s {
 #ifdef	NOTYET
@@ -517,30 +605,7 @@ struct CSV_s {
 #else
     const char *sN;
     CSVtype_t type;
-    union {
-	void *_ptr;
-
-        int *integer;
-        unsigned int *uinteger;
-        double *real;
-        char *string;
-        bool *boolean;
-        char *character;
-
-	int8_t *_i8p;
-	int16_t *_i16p;
-	int32_t *_i32p;
-	int64_t *_i64p;
-	uint8_t *_ui8p;
-	uint16_t *_ui16p;
-	uint32_t *_ui32p;
-	uint64_t *_ui64p;
-	float *_fp;
-	double *_dp;
-	TSTAMP_t *_tstamp;
-	TDIFF_t *_tdiff;
-	FLOAT_t *_float;
-    } attr;
+    size_t off;			/* field offset within the instance */
     union {
 	const char *_dN;
 
@@ -557,8 +622,10 @@ struct CSV_s {
 #endif
 };
 
+/* The tables are offsets, one table serves any number of URG_s instances. */
 #define	_ENTRY(_t, _sN, _dN) \
-	{#_sN, CSVT_##_t, {&_urg._sN}, {#_dN}, sizeof(_urg._sN)}
+	{#_sN, CSVT_##_t, offsetof(struct URG_s, _sN), {#_dN}, \
+		sizeof(((struct URG_s *)0)->_sN)}
 
 static struct CSV_s csvEVENT[] = {		/* #1 */
     _ENTRY(TSTAMP, set.start,		"Set Start"),
@@ -700,6 +767,7 @@ typedef enum TID_s {
     TID_14	= 14,
     TID_15	= 15,
     TID_A2D	= 'A',		/* A/D */
+    TID_BATCH	= 'B',		/* Batch of (TID, CMD, payload) tuples */
     TID_D2A	= 'D',		/* D/A */
     TID_DIO	= 'F',		/* Digital I/O */
     TID_GLOBAL	= 'G',		/* Global state */
@@ -732,10 +800,132 @@ typedef enum CMD_s {
     CMD_READ	= 'r',		/* Read. */
     CMD_WRITE	= 'w',		/* Write. */
     CMD_QUERY	= '?',		/* Query. */
+    CMD_PUSH	= 0x40,		/* Unsolicited A2D sample (ORed with index). */
     CMD_NAK	= 0x80,		/* NAK. */
 } CMD_t;
 
+/* CMD_PUSH ORed with a channel index, and nothing else ('q' has 0x40 too). */
+#define	_CMD_ISPUSH(_cmd)	(((_cmd) & ~(_CMD_NDEVS - 1)) == CMD_PUSH)
+
+/* Incremental frame decoder: accumulates stream bytes across reads. */
+typedef struct DEC_s * DEC_t;
+struct DEC_s {
+    size_t off;		/* start of undecoded bytes */
+    size_t nb;		/* end of buffered bytes */
+    size_t nframes;	/* no. of frames emitted */
+    size_t ndropped;	/* no. of bytes discarded resyncing */
+    size_t nresync;	/* no. of times sync was lost */
+    size_t ncrc;	/* no. of frames failing the CRC */
+    size_t nframing;	/* no. of malformed frames */
+    int resync;		/* discarding bytes, errors already counted */
+    size_t scan;	/* skip-ahead resumes here: earlier offsets cannot start a frame */
+    int stalled;	/* the peer went quiet with a partial frame pending */
+    size_t held;	/* frames before this were buffered when it did */
+    int late;		/* the frame last emitted was held behind a stall */
+    int eof;		/* peer closed the link */
+    uint8_t b[4 * MSGBUFLEN];
+};
+
+/* Fixed pool of frame buffers: no heap traffic on the command path. */
+#define	_IO_NBUFS	8
+typedef struct POOL_s * POOL_t;
+struct POOL_s {
+    uint32_t busy;		/* bit i set if b[i] is in use */
+    size_t nget;		/* no. of buffers handed out */
+    size_t nheap;		/* no. of heap fallbacks (pool exhausted) */
+    uint8_t b[_IO_NBUFS][MSGBUFLEN];
+};
+
+/* Readiness-driven event loop: one per process, shared by all links. */
+typedef struct LOOP_s * LOOP_t;
+struct LOOP_s {
+    pid_t pid;		/* owner (descriptors are not shared across fork) */
+    int epfd;
+    int sigfd;		/* SIGTERM */
+    int tmfd;		/* timeouts */
+};
+
+/* io_uring submission/completion rings for one link. */
+typedef struct URING_s * URING_t;
+#if defined(linux) && defined(__NR_io_uring_setup)
+struct URING_s {
+    int fd;
+    int fixed;			/* buffers registered? */
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void * sq_ptr;
+    size_t sq_sz;
+    void * cq_ptr;
+    size_t cq_sz;
+    size_t sqes_sz;
+    unsigned sqe_tail;		/* next SQE to fill (published at _UringPush) */
+    int nqueued;		/* no. of SQEs not yet submitted */
+    int wpending;
+    int wres;
+    int rpending;
+    int rdone;
+    int rres;
+    size_t nenter;		/* no. of io_uring_enter() calls */
+    struct __kernel_timespec ts;
+};
+#endif
+
+/* Shared memory link: a lock-free SPSC byte ring in each direction. */
+typedef struct SHM_s * SHM_t;
+#if defined(linux) && defined(__NR_memfd_create) && defined(__NR_futex)
+#define	_SHM_RINGSZ	4096		/* power of 2 */
+struct SHMRING_s {
+    uint32_t head;		/* consumer position */
+    uint8_t _pad0[60];
+    uint32_t tail;		/* producer position */
+    uint8_t _pad1[60];
+    uint32_t futex;		/* bumped on each wakeup */
+    uint32_t waiting;		/* consumer is (about to be) asleep */
+    size_t nwake;		/* no. of FUTEX_WAKE calls (producer) */
+    size_t nwait;		/* no. of FUTEX_WAIT calls (consumer) */
+    uint8_t b[_SHM_RINGSZ];
+};
+struct SHM_s {
+    struct SHMRING_s r[2];	/* [0] NUC -> AVR, [1] AVR -> NUC */
+};
+#endif
+
 typedef struct IO_s * IO_t;
+
+/* Asynchronous command: queued by _Submit, completed by callback. */
+#define	_IO_MAXWINDOW	32
+typedef void (*DONE_t) (IO_t io, void *arg, int rc, uint16_t retval);
+typedef struct REQ_s * REQ_t;
+struct REQ_s {
+    REQ_t next;
+    TID_t tid;
+    CMD_t cmd;
+    uint8_t seq;
+    int nretry;
+    long rto;			/* response timeout when last sent (usecs) */
+    struct timeval wtv;		/* last sent */
+    uint64_t wns;		/* last sent (CLOCK_MONOTONIC nsecs) */
+    uint64_t nsencode;		/* last _Load duration */
+    uint64_t nssend;		/* last Set duration */
+    DONE_t done;
+    void *arg;
+    size_t npay;
+    uint8_t pay[MSGBUFLEN];
+};
+struct REQQ_s {
+    REQ_t head;
+    REQ_t *tail;
+    size_t n;
+};
+
 struct IO_s {
     const char * role;
     const char *fmt;
@@ -743,7 +933,21 @@ struct IO_s {
     int fdno;
 
     int sv[2];
-    
+    uint32_t baud;	/* serial line rate (0 if not a tty) */
+    URG_t urg;		/* device state */
+    size_t ncmds;	/* no. of commands completed */
+    int quit;		/* CMD_QUIT received */
+
+    int delay;		/* emulator: usecs before each response */
+    int jitter;		/* emulator: up to this many more usecs */
+    int pdrop;		/* emulator: percent of responses dropped */
+    int pcorrupt;	/* emulator: percent of responses corrupted */
+    unsigned seed;	/* emulator: rand_r() state */
+    uint32_t pushmask;	/* emulator: A2D channels to push */
+    long pushival;	/* emulator: usecs between pushes, 0 if off */
+    struct timeval pushtv;	/* emulator: next push due */
+    size_t npush;	/* no. of A2D samples pushed (avr) or received (nuc) */
+
     int (*Open) (IO_t io);
     int (*Close) (IO_t io);
 
@@ -753,21 +957,39 @@ struct IO_s {
 
     int msgfmt;		/* 0=hex, 1=binary, 2=HDLC-like */
     int ntimeout;
+    int timeout;	/* msecs per response wait */
     int maxtimeouts;
-    int nretry;
+    int txdelay;	/* usecs to sleep after each command is sent */
     int maxretrys;
+    long srtt;		/* smoothed round trip time (usecs) */
+    long rttvar;	/* round trip time variation (usecs) */
+    long rto;		/* response timeout (usecs), 0 until measured */
+    int backoff;	/* RTO doublings since the last RTT sample */
+    size_t nrtt;	/* no. of RTT samples */
+    size_t nresend;	/* no. of commands resent */
+    size_t nnak;	/* no. of NAK responses */
+    int window;		/* >0 commands in flight, adds msgfmt 1/2 seq byte */
+    uint8_t nextseq;
+    struct REQQ_s sendq;	/* submitted, waiting for room in the window */
+    struct REQQ_s waitq;	/* sent, waiting for a response */
+    uint32_t reqbusy;		/* bit i set if reqs[i] is queued */
+    struct REQ_s reqs[_IO_MAXWINDOW];
 
     struct timeval rtv;
     struct iovec riov;
     struct timeval wtv;
     struct iovec wiov;
+    uint64_t rns;		/* rtv and wtv as CLOCK_MONOTONIC nsecs */
+    uint64_t wns;
 
     size_t nb;
     uint8_t *b;
     uint8_t * bs;
+    uint8_t * bp;		/* payload start */
     uint8_t * be;
     uint16_t val;
     uint16_t retval;
+    uint8_t seq;
     TID_t tid;
     CMD_t cmd;
     char valid;
@@ -779,6 +1001,15 @@ struct IO_s {
     uint16_t Pvals[_CMD_NDEVS];
     uint16_t Spos;
 
+    uint8_t retb[MSGBUFLEN];	/* packed TID_BATCH results */
+    size_t nretb;
+
+    struct DEC_s dec;
+    struct POOL_s pool;
+    LOOP_t loop;
+    int parked;		/* ring full: not watched by the loop until drained */
+    URING_t ring;
+    SHM_t shm;
 };
 
 static volatile int exit_request;
@@ -786,8 +1017,25 @@ sigset_t mask;
 sigset_t omask;
 
 static int _io_debug = 1;
-
-#define	MSGBUFLEN	256
+static int _io_window = 0;
+static int _io_timeout = 1000;
+static int _io_epoll = 0;
+static int _io_uring = 0;
+static int _io_shm = 0;
+static const char * _io_tty = NULL;
+static int _io_pty = 0;
+static int _io_lowlatency = 0;
+static int _io_ndevs = 0;
+#if defined(WITH_PTHREADS)
+static int _io_threads = 0;
+#endif
+static int _emu_delay = 0;
+static int _emu_jitter = 0;
+static int _emu_drop = 0;
+static int _emu_corrupt = 0;
+static int _cmd_bench = 0;
+static int _push_msecs = 0;
+static int _io_stats = 0;
 
 /*==============================================================*/
 static int tstamp(struct timeval *tvp)
@@ -798,16 +1046,23 @@ static int tstamp(struct timeval *tvp)
     return rc;
 }
 
+/* Nsecs for intervals: unlike tstamp(), not stepped by NTP or date(1). */
+static uint64_t _Now(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static const char hex[] = "0123456789ABCDEF";
 
-static char * tohex(uint8_t *b, size_t nb)
+/* Format b[] as "XX XX ..." into t[] (truncated to fit). */
+static char * tohex(char *t, size_t nt, const uint8_t *b, size_t nb)
 {
-    size_t nt = (b ? 3 * nb - 1 : 0);
-    char * t = xmalloc(nt+1);
     char *te = t;
 
     if (b && nb)
-    for (size_t i = 0; i < nb; i++) {
+    for (size_t i = 0; i < nb && 3 * (i + 1) < nt; i++) {
 	*te++ = hex[ (*b >> 4) & 0x0F ];
 	*te++ = hex[ (*b     ) & 0x0F ];
 	*te++ = ' ';
@@ -817,44 +1072,383 @@ static char * tohex(uint8_t *b, size_t nb)
     return t;
 }
 
-static char * Xflbl(IO_t io, const char *_fn)
+static const char _io_fmt[] = " %Y-%m-%d %H:%M:%S";
+
+/* Format "rolefn\t(fd):\t timestamp", the prefix of every debug line. */
+static char * _Label(char *b, size_t nb, const char *role, const char *_fn,
+		int fdno, const char *fmt, const struct timeval *tvp)
 {
-    static char b[MSGBUFLEN];
-    size_t nb = sizeof(b);
     char *be = b;
     size_t nf;
 
-    nf = snprintf(be, nb, "%s%s\t(%d):", io->role, _fn, io->fdno);
-	be += nf;
-	nb -= nf;
-     *be++ = '\t';
-     nb--;
+    if (nb == 0)
+	return b;
+    nf = snprintf(be, nb, "%s%s\t(%d):", role, _fn, fdno);
+    if (nf >= nb)		/* truncated */
+	return b;
+    be += nf;
+    nb -= nf;
+    if (nb > 1) {
+	*be++ = '\t';
+	nb--;
+    }
 
-     /* TIMESTAMP */
-    {	struct timeval *tvp = strcmp(io->role, "avr")
-		? &io->rtv : &io->wtv;
-	struct tm tm;
-	nf = strftime(be, nb, io->fmt, gmtime_r(&tvp->tv_sec, &tm));
-	    be += nf;
-	    nb -= nf;
-	nf = snprintf(be, nb, ".%06u", (unsigned)tvp->tv_usec);
-	    be += nf;
-	    nb -= nf;
+    /* TIMESTAMP: the date changes once a second, reuse its text. */
+    {	static __thread char date[64];
+	static __thread size_t ndate;
+	static __thread time_t sec = -1;
+	static __thread const char *datefmt;
+	unsigned usec = tvp->tv_usec;
+	size_t n;
+
+	if (tvp->tv_sec != sec || fmt != datefmt) {
+	    struct tm tm;
+	    ndate = strftime(date, sizeof(date), fmt, gmtime_r(&tvp->tv_sec, &tm));
+	    sec = tvp->tv_sec;
+	    datefmt = fmt;
+	}
+	n = (ndate < nb ? ndate : nb - 1);
+	memcpy(be, date, n);
+	be += n;
+	nb -= n;
+	if (nb >= 8) {		/* ".uuuuuu" and NUL */
+	    *be++ = '.';
+	    for (int i = 5; i >= 0; i--, usec /= 10)
+		be[i] = '0' + (usec % 10);
+	    be += 6;
+	    nb -= 7;
+	}
     }
 
-     *be = '\0';
-     
-     return b;
+    *be = '\0';
+    return b;
+}
+
+static char * Xflbl(IO_t io, const char *_fn)
+{
+    static __thread char b[MSGBUFLEN];
+    struct timeval *tvp = (io->role[0] == 'a' ? &io->wtv : &io->rtv);
+
+    return _Label(b, sizeof(b), io->role, _fn, io->fdno, io->fmt, tvp);
 }
 #define	flbl(_io)	Xflbl((_io), __FUNCTION__)
 
+/*==============================================================*/
+/*
+ * Binary trace: the protocol hot paths append a fixed-size record per
+ * event to an in-memory ring instead of formatting text. Without --trace
+ * each record is rendered to stderr as it is made (the classic output).
+ * With --trace FILE the ring is written to FILE.<pid> at exit (or on a
+ * crash), and --decode FILE renders it later in the same text format.
+ */
+enum TREV_e {
+    TR_NONE	= 0,
+    TR_PARSE,		/* <== _Parse: rc */
+    TR_SET,		/* --> tid[cmd] val */
+    TR_GET,		/* <-- tid[cmd] val */
+    TR_GETSET,		/* <== _GetSet: rc */
+    TR_BATCH,		/* <== _Batch: rc n (val) nfail (aux) */
+    TR_PROCESS,		/* <== _Process: rc */
+    TR_FINISH,		/* <== _Finish: rc retval */
+    TR_CHILD,		/* ==> _Child */
+    TR_READ,		/* read rc bytes at line aux */
+    TR_WRITE,		/* wrote rc bytes at line aux */
+    TR_NEVENTS
+};
+
+typedef struct TREC_s * TREC_t;
+struct TREC_s {
+    uint64_t usecs;	/* the debug line's timestamp */
+    int32_t fdno;
+    int32_t rc;
+    uint16_t val;
+    uint16_t aux;
+    uint8_t ev;
+    uint8_t role;	/* index into _trace_roles[] */
+    uint8_t tid;
+    uint8_t cmd;
+};
+
+struct TRHDR_s {
+    char magic[8];	/* "TURGTRC" */
+    uint32_t reclen;	/* sizeof(struct TREC_s) */
+    uint32_t nrecs;
+};
+
+#define	_TRACE_NRECS	(1 << 16)	/* power of 2 */
+static struct TREC_s _trace[_TRACE_NRECS];
+static uint32_t _trace_ix;		/* next record (wraps) */
+static char _trace_path[PATH_MAX];	/* FILE.<pid> */
+static const char * _io_trace;		/* --trace FILE */
+static const char * _io_decode;		/* --decode FILE */
+
+static const char * _trace_roles[] = { "nuc", "avr", "new" };
+static const char * _trace_fns[TR_NEVENTS] = {
+    [TR_PARSE]	= "_Parse",
+    [TR_SET]	= "_GetSet",
+    [TR_GET]	= "_GetSet",
+    [TR_GETSET]	= "_GetSet",
+    [TR_BATCH]	= "_Batch",
+    [TR_PROCESS] = "_Process",
+    [TR_FINISH]	= "_Finish",
+    [TR_CHILD]	= "_Child",
+    [TR_READ]	= "_Read",
+    [TR_WRITE]	= "_Write",
+};
+
+static const char * _TraceTid(unsigned tid)
+{
+    switch (tid) {
+    case 'A':	return " A2D";
+    case 'B':	return "BTCH";
+    case 'D':	return " D2A";
+    case 'F':	return " DIO";
+    case 'G':	return "GLBL";
+    case 'P':	return "PRES";
+    case 'S':	return "STEP";
+    case 'T':	return "TEMP";
+    }
+    return " ???";
+}
+
+static void _TraceText(FILE *fp, TREC_t r)
+{
+    char b[MSGBUFLEN];
+    struct timeval tv;
+    const char *role = _trace_roles[r->role < 3 ? r->role : 2];
+    const char *fn = (r->ev < TR_NEVENTS && _trace_fns[r->ev]
+			? _trace_fns[r->ev] : "_Trace");
+
+    tv.tv_sec = r->usecs / 1000000;
+    tv.tv_usec = r->usecs % 1000000;
+    (void) _Label(b, sizeof(b), role, fn, r->fdno, _io_fmt, &tv);
+
+    switch (r->ev) {
+    case TR_SET:
+	fprintf(fp, "\t\t\t--> %s[%u] 0x%04X\n", _TraceTid(r->tid), r->cmd, r->val);
+	break;
+    case TR_GET:
+	fprintf(fp, "\t\t\t<-- %s[%u] 0x%04X\n", _TraceTid(r->tid), r->cmd, r->val);
+	break;
+    case TR_BATCH:
+	fprintf(fp, "<== %s: rc %d n %u nfail %u\n", b, r->rc, r->val, r->aux);
+	break;
+    case TR_FINISH:
+	fprintf(fp, "<== %s: rc %d retval %u\n", b, r->rc, r->val);
+	break;
+    case TR_CHILD:
+	fprintf(fp, "==> %s\n", b);
+	break;
+    case TR_READ:
+    case TR_WRITE:
+	fprintf(fp, "<== %s\n\t%s:%u: %s(%d)\n", b, __FILE__, r->aux,
+		(r->ev == TR_READ ? "read" : "write"), r->rc);
+	break;
+    default:
+	fprintf(fp, "<== %s: rc %d\n", b, r->rc);
+	break;
+    }
+}
+
+static uint8_t _TraceRole(IO_t io)
+{
+    return (io->role[0] == 'a' ? 1 : io->role[1] == 'e' ? 2 : 0);
+}
+
+/* Append a record: a slot claim and a few stores, no formatting. */
+static void _Trace(IO_t io, int ev, int rc, unsigned val, unsigned aux)
+{
+    uint32_t ix = __atomic_fetch_add(&_trace_ix, 1, __ATOMIC_RELAXED);
+    TREC_t r = &_trace[ix & (_TRACE_NRECS - 1)];
+    const struct timeval *tvp = (io->role[0] == 'a' ? &io->wtv : &io->rtv);
+
+    r->usecs = (uint64_t) tvp->tv_sec * 1000000 + tvp->tv_usec;
+    r->fdno = io->fdno;
+    r->rc = rc;
+    r->val = val;
+    r->aux = aux;
+    r->ev = ev;
+    r->role = _TraceRole(io);
+    r->tid = io->tid;
+    r->cmd = io->cmd;
+    if (_io_trace == NULL && _io_debug)
+	_TraceText(stderr, r);
+}
+
+/* Start a fresh ring for this process (at startup, and after fork). */
+static void _TraceOpen(void)
+{
+    if (_io_trace == NULL)
+	return;
+    _trace_ix = 0;
+    (void) snprintf(_trace_path, sizeof(_trace_path), "%s.%d",
+		_io_trace, (int) getpid());
+}
+
+/* Write the ring, oldest record first. Async-signal-safe. */
+static void _TraceDump(void)
+{
+    uint32_t ix = _trace_ix;
+    struct TRHDR_s hdr = { .magic = "TURGTRC", .reclen = sizeof(struct TREC_s) };
+    uint32_t i0 = (ix > _TRACE_NRECS ? ix & (_TRACE_NRECS - 1) : 0);
+    int fdno;
+
+    if (_trace_path[0] == '\0')
+	return;
+    fdno = open(_trace_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fdno < 0)
+	return;
+    hdr.nrecs = (ix > _TRACE_NRECS ? _TRACE_NRECS : ix);
+    (void) write(fdno, &hdr, sizeof(hdr));
+    if (i0 > 0)
+	(void) write(fdno, _trace + i0, (_TRACE_NRECS - i0) * sizeof(*_trace));
+    (void) write(fdno, _trace, (hdr.nrecs - (i0 ? _TRACE_NRECS - i0 : 0)) * sizeof(*_trace));
+    (void) close(fdno);
+}
+
+/* SIGUSR1 dumps on demand, fatal signals dump and then die. */
+static void _TraceSignal(int sig)
+{
+    _TraceDump();
+    if (sig == SIGUSR1)
+	return;
+    (void) signal(sig, SIG_DFL);
+    (void) raise(sig);
+}
+
+/* Render a dumped trace file in the debug text format. */
+static int _TraceDecode(const char *fn)
+{
+    FILE *fp = fopen(fn, "r");
+    struct TRHDR_s hdr;
+    struct TREC_s r;
+    int rc = -1;	/* assume failure */
+
+    if (fp == NULL) {
+	perror(fn);
+	goto exit;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+     || strcmp(hdr.magic, "TURGTRC") || hdr.reclen != sizeof(r)) {
+	fprintf(stderr, "%s: not a turg trace\n", fn);
+	goto exit;
+    }
+    for (uint32_t i = 0; i < hdr.nrecs; i++) {
+	if (fread(&r, sizeof(r), 1, fp) != 1)
+	    goto exit;
+	_TraceText(stdout, &r);
+    }
+    rc = 0;
+
+exit:
+    if (fp)
+	(void) fclose(fp);
+    return rc;
+}
+
+/*==============================================================*/
+/*
+ * Wire capture: --capture FILE appends every read and write that crosses
+ * a link, with a monotonic timestamp and direction, to an append-only
+ * file. Each record is one O_APPEND writev(), so forked and threaded
+ * emulators share the file. --replay FILE feeds the received bytes back
+ * through the decoder, _Parse and _Process.
+ */
+typedef struct CAPREC_s * CAPREC_t;
+struct CAPREC_s {
+    uint64_t nsecs;	/* CLOCK_MONOTONIC */
+    uint32_t pid;
+    int32_t fdno;
+    uint16_t len;	/* bytes that follow the record */
+    uint8_t dir;	/* '<' received, '>' sent */
+    uint8_t role;	/* index into _trace_roles[] */
+    uint8_t msgfmt;
+    uint8_t window;
+    uint8_t pad[2];
+};
+
+struct CAPHDR_s {
+    char magic[8];	/* "TURGCAP" */
+    uint32_t reclen;	/* sizeof(struct CAPREC_s) */
+    uint32_t pad;
+};
+
+static int _cap_fdno = -1;
+static const char * _io_capture;	/* --capture FILE */
+static const char * _io_replay;		/* --replay FILE */
+static int _replay_pace;		/* --pace */
+
+/* Open (or continue) the capture file, writing the header if it is new. */
+static int _CaptureOpen(const char *fn)
+{
+    struct CAPHDR_s hdr = { .magic = "TURGCAP", .reclen = sizeof(struct CAPREC_s) };
+    struct stat sb;
+    int rc = -1;	/* assume failure */
+
+    _cap_fdno = open(fn, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if (_cap_fdno < 0 || fstat(_cap_fdno, &sb) < 0) {
+	perror(fn);
+	goto exit;
+    }
+    if (sb.st_size == 0
+     && write(_cap_fdno, &hdr, sizeof(hdr)) != (ssize_t) sizeof(hdr)) {
+	perror(fn);
+	goto exit;
+    }
+    rc = 0;
+
+exit:
+    if (rc && _cap_fdno >= 0) {
+	(void) close(_cap_fdno);
+	_cap_fdno = -1;
+    }
+    return rc;
+}
+
+static void _Capture(IO_t io, int dir, const void *b, size_t nb)
+{
+    struct CAPREC_s r;
+    struct iovec iov[2];
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    memset(&r, 0, sizeof(r));
+    r.nsecs = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    r.pid = getpid();
+    r.fdno = io->fdno;
+    r.len = (nb > UINT16_MAX ? UINT16_MAX : nb);
+    r.dir = dir;
+    r.role = _TraceRole(io);
+    r.msgfmt = io->msgfmt;
+    r.window = (io->window > 0);
+    iov[0].iov_base = &r;
+    iov[0].iov_len = sizeof(r);
+    iov[1].iov_base = (void *) b;
+    iov[1].iov_len = r.len;
+    (void) writev(_cap_fdno, iov, 2);
+}
+
 static ssize_t Xcheck(IO_t io, const char * msg, struct timeval *tvp,
                 ssize_t ret, int printit,
                 const char * func, const char * fn, unsigned ln)
 {
     int rc = (int) ret;
-    if (tvp)
+    if (tvp) {
 	(void) tstamp(tvp);
+	if (tvp == &io->rtv)
+	    io->rns = _Now();
+	else if (tvp == &io->wtv)
+	    io->wns = _Now();
+	if (_io_trace) {
+	    _Trace(io, (tvp == &io->rtv ? TR_READ : TR_WRITE), rc, 0, ln);
+	    printit = 0;
+	}
+	if (_cap_fdno >= 0 && ret > 0 && (tvp == &io->rtv || tvp == &io->wtv)) {
+	    struct iovec *iov = (tvp == &io->rtv ? &io->riov : &io->wiov);
+	    _Capture(io, (tvp == &io->rtv ? '<' : '>'), iov->iov_base,
+			((size_t) ret < iov->iov_len ? (size_t) ret : iov->iov_len));
+	}
+    }
     if ((printit < 0) || (printit > 0 && tvp != NULL) || (rc < 0)) {
 	char t[MSGBUFLEN];
 	size_t nt = sizeof(t);
@@ -864,21 +1458,13 @@ static ssize_t Xcheck(IO_t io, const char * msg, struct timeval *tvp,
                 msg, Xflbl(io, func), fn, ln, msg+4, rc);
 	    te += nf;
 	    nt -= nf;
-	if (tvp == &io->rtv) {
-	    struct iovec *iov = &io->riov;
-	    char *s = tohex((uint8_t *)iov->iov_base, iov->iov_len);
-	    nf = snprintf(te, nt, "\n\t%s", s);
-		te += nf;
-		nt -= nf;
-		free(s);
-	}
-	if (tvp == &io->wtv) {
-	    struct iovec *iov = &io->wiov;
-	    char *s = tohex((uint8_t *)iov->iov_base, iov->iov_len);
-	    nf = snprintf(te, nt, "\n\t%s", s);
-		te += nf;
-		nt -= nf;
-		free(s);
+	if (tvp == &io->rtv || tvp == &io->wtv) {
+	    struct iovec *iov = (tvp == &io->rtv ? &io->riov : &io->wiov);
+	    if (nt > 2) {
+		*te++ = '\n';
+		*te++ = '\t';
+		(void) tohex(te, nt - 2, iov->iov_base, iov->iov_len);
+	    }
 	}
 	fprintf(stderr, "%s\n", t);
     }
@@ -926,66 +1512,499 @@ static const uint16_t fcstab[256] = {
     0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
     0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
 };
-static uint16_t pppfcs(uint16_t fcs, uint8_t *b, size_t nb)
+static uint16_t pppfcs_byte(uint16_t fcs, const uint8_t *b, size_t nb)
 {
     while (nb--)
 	fcs = (fcs >> 8) ^ fcstab[(fcs ^ *b++) & 0xff];
     return fcs;
 }
 
-static int _Load(IO_t io, TID_t tid, CMD_t cmd,
-		const uint8_t *s, size_t ns, struct iovec *iov)
+/* Slice-by-8: fcstab8[k][i] is the FCS of byte i followed by k zero bytes. */
+static uint16_t fcstab8[8][256];
+
+static uint16_t pppfcs_slice8(uint16_t fcs, const uint8_t *b, size_t nb)
 {
-    uint8_t b[MSGBUFLEN];
-    uint8_t * bs = b;
-    uint8_t * be = b;
+    while (nb >= 8) {
+	fcs = fcstab8[7][(fcs ^ b[0]) & 0xff]
+	    ^ fcstab8[6][((fcs >> 8) ^ b[1]) & 0xff]
+	    ^ fcstab8[5][b[2]] ^ fcstab8[4][b[3]]
+	    ^ fcstab8[3][b[4]] ^ fcstab8[2][b[5]]
+	    ^ fcstab8[1][b[6]] ^ fcstab8[0][b[7]];
+	b += 8;
+	nb -= 8;
+    }
+    return pppfcs_byte(fcs, b, nb);
+}
 
-    switch (io->msgfmt) {
-    default:
-    case 2:	/* === binary with start/stop flags. */
-    case 1:	/* === binary without start/stop flags. */
-	if (io->msgfmt == 2) {
-	    *be++ = TWIDDLE;	/* start flag */
-	    bs++;
-	}
-	*be++ = '\0';	/* count */
-	*be++ = tid;	/* target id */
-	*be++ = cmd;	/* target cmd */
-	if (s && ns > 0) {	/* target cmd payload */
-	    (void) memcpy(be, s, ns);
-	    be += ns;
-	}
+#if defined(__x86_64__)
+#include <wmmintrin.h>
+#include <x86intrin.h>
 
-	/* Fill in count. */
-	*bs = (be - bs);
+/*
+ * Carry-less multiply folding (no tables). Registers hold reflected
+ * polynomials: bit m of a 128-bit lane is the coefficient of x^(127-m).
+ * Folding a lane forward by N bits multiplies its high-degree qword by
+ * x^(N+64-1) mod P and its low-degree qword by x^(N-1) mod P (the -1
+ * absorbs the implicit 1-bit shift of a reflected clmul).
+ */
+static __m128i fcsk16;		/* { x^191, x^127 } mod P: fold by 16 bytes */
+static __m128i fcsk64;		/* { x^575, x^511 } mod P: fold by 64 bytes */
 
-	/* Fill in X25/FCS/PPP checksum. */
-	{   uint16_t crc = 0xffff;
-	    crc = pppfcs(crc, bs, (be - bs));
-	    *be++ = ((crc >> 8) & 0xFF);
-	    *be++ = ((crc     ) & 0xFF);
-	}
-	if (io->msgfmt == 2)
-	    *be++ = TWIDDLE;	/* stop flag */
-	break;
-    case 0:	/* === ascii/hex with CR/LF */
-	*be++ = tid;	/* target id */
-	*be++ = cmd;	/* target cmd */
-	if (s && ns > 0) {	/* target cmd payload */
-	    (void) memcpy(be, s, ns);
-	    be += ns;
-	}
-	/* XXX CRC? */
-	*be++ = '\r';
-	*be++ = '\n';
-	break;
+static uint64_t xnmodp(unsigned n)
+{
+    uint32_t r = 1;
+    uint64_t k = 0;
+    while (n--) {
+	r <<= 1;
+	if (r & 0x10000)
+	    r ^= 0x11021;	/* P = x^16 + x^12 + x^5 + 1 */
     }
+    for (int d = 0; d < 16; d++)
+	if (r & (1U << d))
+	    k |= (1ULL << (63 - d));
+    return k;
+}
 
-    if (iov) {
-	iov->iov_base = memcpy(xmalloc(MSGBUFLEN), b, (be - b)); /* xmalloc(be-b) */
-	iov->iov_len = (be - b);
-     }
+__attribute__((target("pclmul,sse2")))
+static inline __m128i _fold(__m128i x, __m128i k, __m128i y)
+{
+    __m128i h = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i l = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(h, l), y);
+}
+
+__attribute__((target("pclmul,sse2")))
+static uint16_t pppfcs_clmul(uint16_t fcs, const uint8_t *b, size_t nb)
+{
+    const __m128i *p = (const __m128i *) b;
+    __m128i x;
+    uint8_t t[16];
+
+    if (nb < 32)
+	return pppfcs_slice8(fcs, b, nb);
+
+    if (nb >= 128) {
+	__m128i x0 = _mm_loadu_si128(p+0);
+	__m128i x1 = _mm_loadu_si128(p+1);
+	__m128i x2 = _mm_loadu_si128(p+2);
+	__m128i x3 = _mm_loadu_si128(p+3);
+	x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128(fcs));
+	p += 4;
+	nb -= 64;
+	while (nb >= 64) {
+	    x0 = _fold(x0, fcsk64, _mm_loadu_si128(p+0));
+	    x1 = _fold(x1, fcsk64, _mm_loadu_si128(p+1));
+	    x2 = _fold(x2, fcsk64, _mm_loadu_si128(p+2));
+	    x3 = _fold(x3, fcsk64, _mm_loadu_si128(p+3));
+	    p += 4;
+	    nb -= 64;
+	}
+	x = _fold(x0, fcsk16, x1);
+	x = _fold(x,  fcsk16, x2);
+	x = _fold(x,  fcsk16, x3);
+    } else {
+	x = _mm_xor_si128(_mm_loadu_si128(p++), _mm_cvtsi32_si128(fcs));
+	nb -= 16;
+    }
+    while (nb >= 16) {
+	x = _fold(x, fcsk16, _mm_loadu_si128(p++));
+	nb -= 16;
+    }
+
+    /* The folded lane is congruent to everything consumed so far. */
+    _mm_storeu_si128((__m128i *)t, x);
+    fcs = pppfcs_slice8(0, t, sizeof(t));
+    return pppfcs_slice8(fcs, (const uint8_t *)p, nb);
+}
+#endif	/* __x86_64__ */
+
+/* The byte loop needs no tables: correct (if slow) until pppfcs_init(). */
+static uint16_t (*_pppfcs) (uint16_t fcs, const uint8_t *b, size_t nb)
+	= pppfcs_byte;
+
+/*
+ * Build the tables and resolve the CRC engine. Call once from main(),
+ * before any thread or fork: the tables and _pppfcs are not published
+ * with any ordering.
+ */
+static void pppfcs_init(void)
+{
+    for (int i = 0; i < 256; i++) {
+	uint16_t t = fcstab[i];
+	fcstab8[0][i] = t;
+	for (int k = 1; k < 8; k++) {
+	    t = (t >> 8) ^ fcstab[t & 0xff];
+	    fcstab8[k][i] = t;
+	}
+    }
+    _pppfcs = pppfcs_slice8;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("pclmul")) {
+	fcsk16 = _mm_set_epi64x(xnmodp(127), xnmodp(191));
+	fcsk64 = _mm_set_epi64x(xnmodp(511), xnmodp(575));
+	_pppfcs = pppfcs_clmul;
+    }
+#endif
+}
+
+static uint16_t pppfcs(uint16_t fcs, uint8_t *b, size_t nb)
+{
+    return (*_pppfcs) (fcs, b, nb);
+}
+
+/*==============================================================*/
+static uint64_t _cycles(void)
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static int _DoCRC(rpmmqtt mqtt)
+{
+    static const struct {
+	const char *name;
+	uint16_t (*fcs) (uint16_t fcs, const uint8_t *b, size_t nb);
+    } engines[] = {
+	{ "byte",	pppfcs_byte },
+	{ "slice8",	pppfcs_slice8 },
+#if defined(__x86_64__)
+	{ "clmul",	pppfcs_clmul },
+#endif
+    };
+    size_t nengines = (sizeof(engines)/sizeof(engines[0]));
+    static const size_t sizes[] = { 7, 16, 32, 64, 128, 256, 1024, 4096 };
+    size_t nsizes = (sizeof(sizes)/sizeof(sizes[0]));
+    size_t nb = 4096 + 64;
+    uint8_t *b = xmalloc(nb);
+    int rc = 0;
+
+    for (size_t i = 0; i < nb; i++)
+	b[i] = random();
+
+    /* Verify every engine is bit-identical to the byte loop. */
+    for (size_t n = 0; n <= 300; n++)
+    for (size_t j = 0; j < nengines; j++) {
+#if defined(__x86_64__)
+	if (engines[j].fcs == pppfcs_clmul && _pppfcs != pppfcs_clmul)
+	    continue;
+#endif
+	uint16_t want = pppfcs_byte(0xffff, b + (n & 7), n);
+	uint16_t got = engines[j].fcs(0xffff, b + (n & 7), n);
+	if (got != want) {
+	    fprintf(stderr, "*** %s: %s nb %zu: 0x%04X != 0x%04X\n",
+			__FUNCTION__, engines[j].name, n, got, want);
+	    rc = -1;
+	}
+    }
+
+    fprintf(stderr, "%8s", "bytes");
+    for (size_t j = 0; j < nengines; j++)
+	fprintf(stderr, " %10s", engines[j].name);
+    fprintf(stderr, "\t(bytes/%s)\n",
+#if defined(__x86_64__)
+		"cycle"
+#else
+		"nsec"
+#endif
+	);
+    for (size_t i = 0; i < nsizes; i++) {
+	size_t n = sizes[i];
+	size_t nloops = (1 << 22) / n + 1;
+	fprintf(stderr, "%8zu", n);
+	for (size_t j = 0; j < nengines; j++) {
+	    volatile uint16_t crc = 0;
+	    uint64_t t0, t1;
+#if defined(__x86_64__)
+	    if (engines[j].fcs == pppfcs_clmul && _pppfcs != pppfcs_clmul) {
+		fprintf(stderr, " %10s", "-");
+		continue;
+	    }
+#endif
+	    t0 = _cycles();
+	    for (size_t k = 0; k < nloops; k++)
+		crc ^= engines[j].fcs(0xffff, b, n);
+	    t1 = _cycles();
+	    fprintf(stderr, " %10.3f", (double)(n * nloops) / (t1 - t0));
+	}
+	fprintf(stderr, "\n");
+    }
+
+    free(b);
+    return rc;
+}
+
+/*==============================================================*/
+static void * _BufGet(IO_t io)
+{
+    POOL_t pool = &io->pool;
+    pool->nget++;
+    for (int i = 0; i < _IO_NBUFS; i++) {
+	if (pool->busy & (1U << i))
+	    continue;
+	pool->busy |= (1U << i);
+	return pool->b[i];
+    }
+    pool->nheap++;
+    return xmalloc(MSGBUFLEN);
+}
+
+static void * _BufPut(IO_t io, void * p)
+{
+    POOL_t pool = &io->pool;
+    if (p == NULL)
+	return NULL;
+    /* Frame views into the receive ring are not owned. */
+    if ((uint8_t *)p >= io->dec.b && (uint8_t *)p < io->dec.b + sizeof(io->dec.b))
+	return NULL;
+    if ((uint8_t *)p >= pool->b[0] && (uint8_t *)p < pool->b[_IO_NBUFS]) {
+	int i = ((uint8_t *)p - pool->b[0]) / MSGBUFLEN;
+	pool->busy &= ~(1U << i);
+    } else
+	free(p);
+    return NULL;
+}
+
+static int _Load(IO_t io, TID_t tid, CMD_t cmd,
+		const uint8_t *s, size_t ns, struct iovec *iov)
+{
+    uint8_t * b = _BufGet(io);
+    uint8_t * bs = b;
+    uint8_t * be = b;
+
+    switch (io->msgfmt) {
+    default:
+    case 2:	/* === binary with start/stop flags. */
+    case 1:	/* === binary without start/stop flags. */
+	if (io->msgfmt == 2) {
+	    *be++ = TWIDDLE;	/* start flag */
+	    bs++;
+	}
+	*be++ = '\0';	/* count */
+	if (io->window > 0)
+	    *be++ = io->seq;	/* sequence no. */
+	*be++ = tid;	/* target id */
+	*be++ = cmd;	/* target cmd */
+	if (s && ns > 0) {	/* target cmd payload */
+	    (void) memcpy(be, s, ns);
+	    be += ns;
+	}
+
+	/* Fill in count. */
+	*bs = (be - bs);
+
+	/* Fill in X25/FCS/PPP checksum. */
+	{   uint16_t crc = 0xffff;
+	    crc = pppfcs(crc, bs, (be - bs));
+	    *be++ = ((crc >> 8) & 0xFF);
+	    *be++ = ((crc     ) & 0xFF);
+	}
+	if (io->msgfmt == 2)
+	    *be++ = TWIDDLE;	/* stop flag */
+	break;
+    case 0:	/* === ascii/hex with CR/LF */
+	*be++ = tid;	/* target id */
+	*be++ = cmd;	/* target cmd */
+	if (s && ns > 0) {	/* target cmd payload */
+	    (void) memcpy(be, s, ns);
+	    be += ns;
+	}
+	/* XXX CRC? */
+	*be++ = '\r';
+	*be++ = '\n';
+	break;
+    }
+
+    if (iov) {
+	iov->iov_base = b;
+	iov->iov_len = (be - b);
+    } else
+	b = _BufPut(io, b);
+
+    return 0;
+}
+
+/*==============================================================*/
+/*
+ * Return the free tail of the receive ring in iov: reads land there
+ * directly, and _DecAdd() then hands the bytes to the decoder. A link
+ * drained while its owner is busy elsewhere can fill the ring with frames
+ * not yet decoded, so the free tail may be empty.
+ */
+static size_t _DecSpace(DEC_t dec, struct iovec *iov)
+{
+    /* Compact: previously emitted frames are no longer referenced. */
+    if (dec->off > 0) {
+	if (dec->nb > dec->off)
+	    (void) memmove(dec->b, dec->b + dec->off, dec->nb - dec->off);
+	dec->nb -= dec->off;
+	dec->scan = (dec->scan > dec->off ? dec->scan - dec->off : 0);
+	dec->held = (dec->held > dec->off ? dec->held - dec->off : 0);
+	dec->off = 0;
+    }
+    iov->iov_base = dec->b + dec->nb;
+    iov->iov_len = sizeof(dec->b) - dec->nb;
+    return iov->iov_len;
+}
+
+/*
+ * Account for nr bytes read into the ring tail, setting iov to them.
+ * Reading nothing is EOF only if the ring had room for something.
+ */
+static ssize_t _DecAdd(DEC_t dec, struct iovec *iov, ssize_t nr)
+{
+    if (nr == 0 && iov->iov_len > 0)
+	dec->eof = 1;
+    iov->iov_base = dec->b + dec->nb;
+    iov->iov_len = (nr > 0 ? nr : 0);
+    dec->nb += iov->iov_len;
+    return nr;
+}
 
+/*
+ * Return frame length at bs, 0 if incomplete, -1 if bs cannot start one
+ * (-2 if only its CRC is wrong).
+ */
+static ssize_t _DecFrame(const uint8_t *bs, size_t nb, int msgfmt)
+{
+    ssize_t nf = 0;
+
+    switch (msgfmt) {
+    default:
+    case 2:	/* === binary with start/stop flags. */
+    case 1:	/* === binary without start/stop flags. */
+    {	size_t nflags = (msgfmt == 1 ? 0 : 2);
+	const uint8_t * fs = bs + nflags/2;
+	if (nflags && bs[0] != TWIDDLE)
+	    return -1;
+	if (nb < 1 + nflags/2)
+	    return 0;
+	if (fs[0] < 3 || (size_t)fs[0] + 2 + nflags > MSGBUFLEN)
+	    return -1;
+	nf = fs[0] + 2 + nflags;
+	if (nb < (size_t)nf)
+	    return 0;
+	if (nflags && bs[nf-1] != TWIDDLE)
+	    return -1;
+	{   uint16_t crc = pppfcs(0xffff, (uint8_t *)fs, fs[0]);
+	    if (fs[fs[0]] != ((crc >> 8) & 0xFF)
+	     || fs[fs[0]+1] != ((crc     ) & 0xFF))
+		return -2;	/* CRC */
+	}
+    }	break;
+    case 0:	/* === ascii/hex with CR/LF */
+    {	const uint8_t * be = memchr(bs, '\n', nb);
+	if (be == NULL)
+	    return (nb < MSGBUFLEN ? 0 : -1);
+	nf = (be - bs) + 1;
+	if (nf < 4 || bs[nf-2] != '\r')
+	    return -1;
+    }	break;
+    }
+    return nf;
+}
+
+/*
+ * The peer went quiet: if a partial frame is pending, it may never
+ * complete, so let _DecGet() try every offset after it again.
+ */
+static void _DecStall(DEC_t dec)
+{
+    if (dec->off < dec->nb) {
+	dec->stalled = 1;
+	dec->scan = 0;
+	dec->held = dec->nb;
+    }
+}
+
+/*
+ * Extract the next complete frame, or return 0 if more bytes are needed.
+ * The frame is returned in iov, which points into the decoder buffer and
+ * stays valid until the next _DecSpace(). Bytes that cannot begin a valid
+ * frame are discarded until the stream resynchronizes.
+ */
+static int _DecGet(DEC_t dec, int msgfmt, struct iovec *iov)
+{
+    while (dec->off < dec->nb) {
+	uint8_t * bs = dec->b + dec->off;
+	size_t nb = dec->nb - dec->off;
+	ssize_t nf = _DecFrame(bs, nb, msgfmt);
+
+	if (nf < 0) {
+	    /* Count the frame that lost sync, not each byte skipped after. */
+	    if (!dec->resync) {
+		if (nf == -2)
+		    dec->ncrc++;
+		else
+		    dec->nframing++;
+		dec->nresync++;
+		dec->resync = 1;
+	    }
+	    if (msgfmt == 0) {		/* discard the whole bad line */
+		const uint8_t * be = memchr(bs, '\n', nb);
+		nf = (be ? (be - bs) + 1 : 1);
+	    } else
+		nf = 1;
+	    dec->ndropped += nf;
+	    dec->off += nf;
+	    continue;
+	}
+
+	/*
+	 * A corrupt count can stall waiting for bytes that a stop-and-wait
+	 * peer will never send, and so can a byte taken for a count while
+	 * resyncing: after a CRC/framing failure, or once the peer went quiet
+	 * (_DecStall), skip ahead to a later complete frame. Not while a
+	 * frame in sync is still arriving: its payload can hold what looks
+	 * like a frame (msgfmt 1 has no flags). Offsets are tried from the
+	 * first one still incomplete, not all of them on every read, which
+	 * would run the CRC O(n^2) times on a slow link.
+	 */
+	if (nf == 0 && msgfmt != 0) {
+	    size_t j = 1;
+	    size_t jpend = nb;		/* first offset still incomplete */
+
+	    if (!dec->stalled && !dec->resync)
+		return 0;
+	    if (dec->scan > dec->off + 1)
+		j = dec->scan - dec->off;
+	    for (; j < nb; j++) {
+		if ((nf = _DecFrame(bs + j, nb - j, msgfmt)) == 0) {
+		    if (jpend == nb)
+			jpend = j;
+		} else if (nf > 0) {
+		    if (!dec->resync) {
+			dec->nframing++;
+			dec->nresync++;
+		    }
+		    dec->ndropped += j;
+		    dec->off += j;
+		    bs += j;
+		    break;
+		}
+	    }
+	    if (nf <= 0) {
+		dec->scan = dec->off + jpend;
+		return 0;
+	    }
+	}
+	if (nf == 0)
+	    return 0;
+
+	iov->iov_base = bs;
+	iov->iov_len = nf;
+	dec->late = (dec->off < dec->held);
+	dec->off += nf;
+	dec->nframes++;
+	dec->resync = 0;
+	dec->stalled = 0;
+	dec->scan = 0;
+	return 1;
+    }
     return 0;
 }
 
@@ -998,6 +2017,130 @@ static int _Socketpair(IO_t io)
     return rc;
 }
 
+/* Map a line rate to its termios speed, B0 if unsupported. */
+static speed_t _Speed(uint32_t baud)
+{
+    static const struct { uint32_t baud; speed_t speed; } _speeds[] = {
+	{   1200, B1200 },	{   2400, B2400 },	{   4800, B4800 },
+	{   9600, B9600 },	{  19200, B19200 },	{  38400, B38400 },
+	{  57600, B57600 },	{ 115200, B115200 },	{ 230400, B230400 },
+    };
+    for (size_t i = 0; i < sizeof(_speeds)/sizeof(_speeds[0]); i++) {
+	if (_speeds[i].baud == baud)
+	    return _speeds[i].speed;
+    }
+    return B0;
+}
+
+/*
+ * Configure a tty as a raw 8N1 link at baud. VMIN=1/VTIME=0 returns from
+ * read() as soon as a byte arrives (the decoder reassembles frames), and
+ * low latency mode disables the driver's receive batching if asked.
+ */
+static int _SerialConfig(IO_t io, int fd, uint32_t baud)
+{
+    speed_t speed = _Speed(baud);
+    struct termios tio;
+    int rc = -1;	/* assume failure */
+
+    if (speed == B0) {
+fprintf(stderr, "    %s:	unsupported baud rate %u\n", flbl(io), baud);
+	goto exit;
+    }
+    if (check(io, "    tcgetattr", NULL, tcgetattr(fd, &tio)) < 0)
+	goto exit;
+
+    tio.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL|IXON|IXOFF);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO|ECHONL|ICANON|ISIG|IEXTEN);
+    tio.c_cflag &= ~(CSIZE|PARENB|CSTOPB);
+#if defined(CRTSCTS)
+    tio.c_cflag &= ~CRTSCTS;
+#endif
+    tio.c_cflag |= CS8|CLOCAL|CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    (void) cfsetispeed(&tio, speed);
+    (void) cfsetospeed(&tio, speed);
+    if (check(io, "    tcsetattr", NULL, tcsetattr(fd, TCSADRAIN, &tio)) < 0)
+	goto exit;
+    io->baud = baud;
+
+#if defined(linux) && defined(ASYNC_LOW_LATENCY)
+    if (_io_lowlatency) {
+	struct serial_struct ss;
+	if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+	    ss.flags |= ASYNC_LOW_LATENCY;
+	    (void) check(io, "    ioctl(TIOCSSERIAL)", NULL,
+			ioctl(fd, TIOCSSERIAL, &ss));
+	} else
+fprintf(stderr, "    %s:	no low latency mode: %s\n", flbl(io), strerror(errno));
+    }
+#endif
+    rc = 0;
+
+exit:
+    return rc;
+}
+
+/* Open the serial device (no local peer: the AVR is on the wire). */
+static int _Serial(IO_t io)
+{
+    int rc = -1;	/* assume failure */
+
+    io->sv[0] = check(io, "    open", NULL,
+		open(_io_tty, O_RDWR|O_NOCTTY));
+    if (io->sv[0] < 0)
+	goto exit;
+    if (_SerialConfig(io, io->sv[0], io->urg->baud_rate))
+	goto exit;
+    (void) tcflush(io->sv[0], TCIOFLUSH);
+    rc = 0;
+
+exit:
+    if (rc && io->sv[0] >= 0) {
+	(void) close(io->sv[0]);
+	io->sv[0] = -1;
+    }
+    (void) tstamp(&io->rtv);
+    io->wtv = io->rtv;		/* structure assignment */
+    return rc;
+}
+
+/* Open a pty pair: the master is the NUC end, the slave the AVR's UART. */
+static int _Pty(IO_t io)
+{
+    int rc = -1;	/* assume failure */
+
+    io->sv[0] = check(io, "    posix_openpt", NULL,
+		posix_openpt(O_RDWR|O_NOCTTY));
+    if (io->sv[0] < 0)
+	goto exit;
+    if (check(io, "    grantpt", NULL, grantpt(io->sv[0])) < 0
+     || check(io, "    unlockpt", NULL, unlockpt(io->sv[0])) < 0)
+	goto exit;
+    io->sv[1] = check(io, "    open(pts)", NULL,
+		open(ptsname(io->sv[0]), O_RDWR|O_NOCTTY));
+    if (io->sv[1] < 0)
+	goto exit;
+    if (_SerialConfig(io, io->sv[1], io->urg->baud_rate))
+	goto exit;
+    (void) tcflush(io->sv[1], TCIOFLUSH);
+    rc = 0;
+
+exit:
+    if (rc) {
+	for (int i = 0; i < 2; i++) {
+	    if (io->sv[i] >= 0)
+		(void) close(io->sv[i]);
+	    io->sv[i] = -1;
+	}
+    }
+    (void) tstamp(&io->rtv);
+    io->wtv = io->rtv;		/* structure assignment */
+    return rc;
+}
+
 static int _Close(IO_t io)
 {
     int rc = check(io, "    close", NULL,
@@ -1009,21 +2152,11 @@ static int _Close(IO_t io)
 static ssize_t _Read(IO_t io)
 {
     struct iovec *iov = &io->riov;
-    int navail;
     ssize_t rc;
-#if defined(linux)
-    rc = check(io, "==> ioctl(FIONREAD)", NULL,
-		ioctl(io->fdno, FIONREAD, &navail));
-#else
-    navail = MSGBUFLEN;
-#endif
-
-    iov->iov_len = navail;
-    iov->iov_base = _free(iov->iov_base);
-    iov->iov_base = xmalloc(MSGBUFLEN);		/* xmalloc(iov->iov_len) */
 
+    (void) _DecSpace(&io->dec, iov);
     rc = check(io, "<== read", &io->rtv,
-		(iov->iov_len = read(io->fdno, iov->iov_base, iov->iov_len)));
+		_DecAdd(&io->dec, iov, read(io->fdno, iov->iov_base, iov->iov_len)));
     return rc;
 }
 
@@ -1038,22 +2171,11 @@ static ssize_t _Write(IO_t io)
 static ssize_t _Readv(IO_t io)
 {
     struct iovec *iov = &io->riov;
-    int navail;
     ssize_t rc;
-#if defined(linux)
-    rc = check(io, "==> ioctl(FIONREAD)", NULL,
-		ioctl(io->fdno, FIONREAD, &navail));
-#else
-    navail = MSGBUFLEN;
-#endif
-
-
-    iov->iov_len = navail;
-    iov->iov_base = _free(iov->iov_base);
-    iov->iov_base = xmalloc(MSGBUFLEN);		/* xmalloc(iov->iov_len) */
 
+    (void) _DecSpace(&io->dec, iov);
     rc = check(io, "<== readv", &io->rtv,
-		(iov->iov_len = readv(io->fdno, iov, 1)));
+		_DecAdd(&io->dec, iov, readv(io->fdno, iov, 1)));
     return rc;
 }
 
@@ -1071,21 +2193,11 @@ static ssize_t _Recv(IO_t io)
 {
     struct iovec *iov = &io->riov;
     static int _flags = 0;
-    int navail;
-    int rc;
-#if defined(linux)
-    rc = check(io, "==> ioctl(FIONREAD)", NULL,
-		ioctl(io->fdno, FIONREAD, &navail));
-#else
-    navail = MSGBUFLEN;
-#endif
-
-    iov->iov_len = navail;
-    iov->iov_base = _free(iov->iov_base);
-    iov->iov_base = xmalloc(MSGBUFLEN);		/* xmalloc(iov->iov_len) */
+    ssize_t rc;
 
+    (void) _DecSpace(&io->dec, iov);
     rc = check(io, "<== recv", &io->rtv,
-		(iov->iov_len = recv(io->fdno, iov->iov_base, iov->iov_len, _flags)));
+		_DecAdd(&io->dec, iov, recv(io->fdno, iov->iov_base, iov->iov_len, _flags)));
 
     return rc;
 }
@@ -1099,48 +2211,788 @@ static ssize_t _Send(IO_t io)
     return rc;
 }
 
+/*
+ * Usecs to wait for a response: the link's RTO once measured. An emulator
+ * pushing samples waits no longer than its next push is due.
+ */
+static long _Wait(IO_t io)
+{
+    long usecs = (io->rto > 0 ? io->rto : 1000L * io->timeout);
+
+    if (io->pushival > 0) {
+	struct timeval now;
+	long due;
+	(void) tstamp(&now);
+	due = (io->pushtv.tv_sec - now.tv_sec) * 1000000L
+		+ (io->pushtv.tv_usec - now.tv_usec);
+	if (due < usecs)
+	    usecs = (due > 0 ? due : 1);	/* 0 would disarm a timerfd */
+    }
+    return usecs;
+}
+
+static struct timespec * _Timeout(IO_t io, struct timespec *ts)
+{
+    long usecs = _Wait(io);
+    ts->tv_sec = usecs / 1000000;
+    ts->tv_nsec = (usecs % 1000000) * 1000;
+    return ts;
+}
+
 static ssize_t _Poll(IO_t io)
 {
+    struct iovec *iov = &io->riov;
     struct timespec ts;
     fd_set rfds;
     int ntimeouts = 0;
+    int ready;
     ssize_t rc = -1;
 
     while (!exit_request) {
-	ts.tv_sec = 1;
-	ts.tv_nsec = 0;
-	FD_ZERO(&rfds);	FD_SET(io->fdno, &rfds);
-	rc = check(io, "==> pselect", NULL,
+	/* Return a frame already buffered by a previous read. */
+	if (_DecGet(&io->dec, io->msgfmt, iov)) {
+	    rc = iov->iov_len;
+	    break;
+	}
+	if (io->fdno < FD_SETSIZE) {
+	    (void) _Timeout(io, &ts);
+	    FD_ZERO(&rfds);	FD_SET(io->fdno, &rfds);
+	    rc = check(io, "==> pselect", NULL,
 		pselect(io->fdno+1, &rfds, NULL, NULL, &ts, &omask));
+	    ready = (rc > 0 && FD_ISSET(io->fdno, &rfds));
+	} else {
+	    /* An fd_set cannot hold the descriptor (e.g. an emulator farm). */
+	    struct pollfd pfd = { .fd = io->fdno, .events = POLLIN };
+	    rc = check(io, "==> poll", NULL,
+		poll(&pfd, 1, (int)((_Wait(io) + 999) / 1000)));
+	    ready = (rc > 0 && pfd.revents);
+	}
 	if (rc < 0 && errno != EINTR) {
-	    perror("pselect");
+	    perror(io->fdno < FD_SETSIZE ? "pselect" : "poll");
 	    exit_request = 1;
 	} else if (exit_request) {
+	    if (_io_debug)
 fprintf(stderr, "    %s:\texit\n", flbl(io));
 	    continue;
 	} else if (rc == 0) {
+	    if (_io_debug)
 fprintf(stderr, "    %s:\ttimeout\n", flbl(io));
 	    ntimeouts++;
 	    if (io->maxtimeouts > 0 && ntimeouts >= io->maxtimeouts)
 		break;
 	    continue;
-	} else if (FD_ISSET(io->fdno, &rfds)) {
+	} else if (ready) {
+	    /* Partial frames wait for more bytes, extra frames are kept. */
 	    rc = io->Get(io);
-	    break;
+	    if (rc <= 0)
+		break;
+	    continue;
 	}
     }
 
     return rc;
 }
 
+#if defined(linux)
 /*==============================================================*/
-typedef struct MSG_s * MSG_t;
-struct MSG_s {
-    TID_t tid;
-    CMD_t cmd;
-    const char *pay;
-    size_t npay;
-};
+static struct LOOP_s _loop = { .pid = 0, .epfd = -1, .sigfd = -1, .tmfd = -1 };
+
+static LOOP_t _LoopGet(IO_t io)
+{
+    LOOP_t loop = &_loop;
+    struct epoll_event ev;
+
+    if (loop->pid != getpid()) {
+	/* Descriptors inherited across fork belong to the parent's loop. */
+	if (loop->epfd >= 0) {
+	    (void) close(loop->epfd);
+	    (void) close(loop->sigfd);
+	    (void) close(loop->tmfd);
+	}
+	loop->pid = getpid();
+	loop->epfd = check(io, "    epoll_create1", NULL,
+		epoll_create1(EPOLL_CLOEXEC));
+	loop->sigfd = check(io, "    signalfd", NULL,
+		signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC));
+	loop->tmfd = check(io, "    timerfd_create", NULL,
+		timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC));
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &loop->sigfd;
+	(void) epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->sigfd, &ev);
+	ev.data.ptr = &loop->tmfd;
+	(void) epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->tmfd, &ev);
+    }
+
+    if (io->loop != loop) {
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = io;
+	(void) check(io, "    epoll_ctl(ADD)", NULL,
+		epoll_ctl(loop->epfd, EPOLL_CTL_ADD, io->fdno, &ev));
+	io->loop = loop;
+	io->parked = 0;
+    }
+    return loop;
+}
+
+/* Watch (or stop watching) a link's fd for input. */
+static void _LoopArm(IO_t io, int arm)
+{
+    struct epoll_event ev;
+
+    if (io->loop == NULL || io->parked == !arm)
+	return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (arm ? EPOLLIN : 0);
+    ev.data.ptr = io;
+    (void) check(io, "    epoll_ctl(MOD)", NULL,
+		epoll_ctl(io->loop->epfd, EPOLL_CTL_MOD, io->fdno, &ev));
+    io->parked = !arm;
+}
+
+/* Watch a parked link again once decoding has made room in its ring. */
+static void _Unpark(IO_t io)
+{
+    struct iovec iov;
+
+    if (io->parked && _DecSpace(&io->dec, &iov) > 0)
+	_LoopArm(io, 1);
+}
+
+/*
+ * Read whatever is available on a ready link into its decoder. A ring
+ * full of frames not yet decoded is not read: the link is parked (its fd
+ * is level-triggered and would be reported again at once) until
+ * _Unpark(), and the buffered byte count is returned so the link is not
+ * taken for closed.
+ */
+static ssize_t _Drain(IO_t io)
+{
+    struct iovec iov;
+    ssize_t rc;
+
+    if (_DecSpace(&io->dec, &iov) == 0) {
+	_LoopArm(io, 0);
+	return io->dec.nb;
+    }
+    rc = io->Get(io);
+
+    if (rc <= 0 && io->loop) {
+	/* EOF or error: stop watching the link. */
+	(void) epoll_ctl(io->loop->epfd, EPOLL_CTL_DEL, io->fdno, NULL);
+	io->loop = NULL;
+    }
+    return rc;
+}
+
+/*
+ * Wait for the next frame on io, servicing every other link registered
+ * with the loop meanwhile. Timeouts come from a periodic timer,
+ * SIGTERM arrives through the signalfd.
+ */
+static ssize_t _Epoll(IO_t io)
+{
+    LOOP_t loop = _LoopGet(io);
+    struct iovec *iov = &io->riov;
+    struct epoll_event ev[16];
+    struct itimerspec its;
+    uint64_t nexp;
+    int ntimeouts = 0;
+    ssize_t rc = -1;
+
+    memset(&its, 0, sizeof(its));
+    (void) _Timeout(io, &its.it_value);
+    its.it_interval = its.it_value;	/* structure assignment */
+    (void) timerfd_settime(loop->tmfd, 0, &its, NULL);
+
+    while (!exit_request) {
+	int nev;
+
+	/* Return a frame already buffered by a previous read. */
+	if (_DecGet(&io->dec, io->msgfmt, iov)) {
+	    rc = iov->iov_len;
+	    break;
+	}
+	if (io->loop == NULL) {		/* EOF */
+	    rc = 0;
+	    break;
+	}
+	_Unpark(io);
+
+	nev = check(io, "==> epoll_wait", NULL,
+		epoll_wait(loop->epfd, ev, sizeof(ev)/sizeof(ev[0]), -1));
+	if (nev < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("epoll_wait");
+	    exit_request = 1;
+	    break;
+	}
+	for (int i = 0; i < nev; i++) {
+	    void * ptr = ev[i].data.ptr;
+	    if (ptr == &loop->sigfd) {
+		struct signalfd_siginfo ssi;
+		while (read(loop->sigfd, &ssi, sizeof(ssi)) == sizeof(ssi))
+		    exit_request = 1;
+		if (_io_debug)
+fprintf(stderr, "    %s:\texit\n", flbl(io));
+	    } else if (ptr == &loop->tmfd) {
+		if (read(loop->tmfd, &nexp, sizeof(nexp)) == sizeof(nexp))
+		    ntimeouts += nexp;
+		if (_io_debug)
+fprintf(stderr, "    %s:\ttimeout\n", flbl(io));
+	    } else {
+		IO_t xio = ptr;
+		rc = _Drain(xio);
+		if (rc <= 0 && xio == io)
+		    goto exit;
+	    }
+	}
+	if (io->maxtimeouts > 0 && ntimeouts >= io->maxtimeouts) {
+	    rc = 0;
+	    break;
+	}
+    }
+
+exit:
+    memset(&its, 0, sizeof(its));
+    (void) timerfd_settime(loop->tmfd, 0, &its, NULL);
+    return rc;
+}
+#endif	/* linux */
+
+#if defined(linux) && defined(__NR_io_uring_setup)
+/*==============================================================*/
+/*
+ * io_uring transport: the pool and the receive ring are registered once,
+ * sends and receives use READ_FIXED/WRITE_FIXED, and one io_uring_enter()
+ * submits and reaps a batch of completions.
+ */
+#define	_URING_ENTRIES	8
+#define	_URING_WRITE	1
+#define	_URING_READ	2
+#define	_URING_TIMEOUT	3
+
+static URING_t _UringFree(URING_t ring)
+{
+    if (ring) {
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+	    (void) munmap(ring->sqes, ring->sqes_sz);
+	if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED
+	 && ring->cq_ptr != ring->sq_ptr)
+	    (void) munmap(ring->cq_ptr, ring->cq_sz);
+	if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+	    (void) munmap(ring->sq_ptr, ring->sq_sz);
+	if (ring->fd >= 0)
+	    (void) close(ring->fd);
+	free(ring);
+    }
+    return NULL;
+}
+
+static URING_t _UringNew(IO_t io)
+{
+    URING_t ring = xcalloc(1, sizeof(*ring));
+    struct io_uring_params p;
+    struct iovec iovs[2];
+    uint8_t * sq;
+    uint8_t * cq;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = check(io, "    io_uring_setup", NULL,
+		syscall(__NR_io_uring_setup, _URING_ENTRIES, &p));
+    if (ring->fd < 0)
+	goto errxit;
+
+    ring->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (ring->cq_sz > ring->sq_sz)
+	    ring->sq_sz = ring->cq_sz;
+	ring->cq_sz = ring->sq_sz;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_sz, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+	goto errxit;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	ring->cq_ptr = ring->sq_ptr;
+    else
+	ring->cq_ptr = mmap(NULL, ring->cq_sz, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED)
+	goto errxit;
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+	goto errxit;
+
+    sq = ring->sq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    cq = ring->cq_ptr;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* Register the frame pool (buf_index 0) and receive ring (1). */
+    iovs[0].iov_base = io->pool.b;
+    iovs[0].iov_len = sizeof(io->pool.b);
+    iovs[1].iov_base = io->dec.b;
+    iovs[1].iov_len = sizeof(io->dec.b);
+    ring->fixed = (check(io, "    io_uring_register", NULL,
+		syscall(__NR_io_uring_register, ring->fd,
+			IORING_REGISTER_BUFFERS, iovs, 2)) == 0);
+    return ring;
+
+errxit:
+    return _UringFree(ring);
+}
+
+/* Return the link's ring, reverting to readv/writev/pselect without one. */
+static URING_t _UringGet(IO_t io)
+{
+    if (io->ring == NULL) {
+	io->ring = _UringNew(io);
+	if (io->ring == NULL) {
+fprintf(stderr, "    %s:\tio_uring unavailable\n", flbl(io));
+	    io->Chk = _Poll;
+	    io->Get = _Readv;
+	    io->Set = _Writev;
+	}
+    }
+    return io->ring;
+}
+
+/*
+ * Return the next free SQE, zeroed. It is not visible to the kernel until
+ * the caller has filled it in and called _UringPush().
+ */
+static struct io_uring_sqe * _UringSqe(URING_t ring)
+{
+    unsigned tail = ring->sqe_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned ix;
+    struct io_uring_sqe * sqe;
+
+    if (tail - head >= ring->sq_entries)
+	return NULL;
+    ix = tail & *ring->sq_mask;
+    sqe = ring->sqes + ix;
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[ix] = ix;
+    ring->sqe_tail = tail + 1;
+    return sqe;
+}
+
+/* Publish the SQEs filled in since the last push. */
+static void _UringPush(URING_t ring)
+{
+    unsigned tail = *ring->sq_tail;
+
+    ring->nqueued += ring->sqe_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+}
+
+/* Submit queued entries, waiting for at least min_complete completions. */
+static int _UringEnter(IO_t io, unsigned min_complete)
+{
+    URING_t ring = io->ring;
+    int rc;
+
+    rc = syscall(__NR_io_uring_enter, ring->fd, ring->nqueued, min_complete,
+		(min_complete ? IORING_ENTER_GETEVENTS : 0),
+		(min_complete ? &omask : NULL), _NSIG / 8);
+    ring->nenter++;
+    if (rc >= 0)
+	ring->nqueued -= rc;
+    return rc;
+}
+
+/* Reap all available completions. */
+static void _UringReap(IO_t io)
+{
+    URING_t ring = io->ring;
+    unsigned head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+	struct io_uring_cqe * cqe = ring->cqes + (head & *ring->cq_mask);
+	switch (cqe->user_data) {
+	case _URING_WRITE:
+	    ring->wpending--;
+	    ring->wres = cqe->res;
+	    break;
+	case _URING_READ:
+	    ring->rpending = 0;
+	    ring->rres = cqe->res;
+	    ring->rdone = 1;
+	    break;
+	case _URING_TIMEOUT:
+	default:
+	    break;
+	}
+	head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static ssize_t _UringWritev(IO_t io)
+{
+    URING_t ring = _UringGet(io);
+    struct iovec *iov = &io->wiov;
+    struct io_uring_sqe * sqe;
+    uint8_t * b = iov->iov_base;
+    ssize_t rc;
+
+    if (ring == NULL)
+	return io->Set(io);
+
+    while ((sqe = _UringSqe(ring)) == NULL) {
+	(void) _UringEnter(io, 1);
+	_UringReap(io);
+    }
+    sqe->fd = io->fdno;
+    sqe->addr = (uintptr_t) b;
+    sqe->len = iov->iov_len;
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = _URING_WRITE;
+    if (ring->fixed && b >= io->pool.b[0] && b < io->pool.b[_IO_NBUFS]) {
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->buf_index = 0;
+    } else
+	sqe->opcode = IORING_OP_WRITE;
+    _UringPush(ring);
+    ring->wpending++;
+
+    /* Socket writes usually complete inline with the submit. */
+    (void) _UringEnter(io, 0);
+    _UringReap(io);
+    while (ring->wpending > 0 && !exit_request) {
+	if (_UringEnter(io, 1) < 0 && errno != EINTR)
+	    break;
+	_UringReap(io);
+    }
+
+    if (ring->wres < 0)
+	errno = -ring->wres;
+    rc = check(io, "<== uring write", &io->wtv, ring->wres);
+    return rc;
+}
+
+/* Queue a read into the receive ring tail, optionally linked to a timeout. */
+static void _UringQueueRead(IO_t io, int timed)
+{
+    URING_t ring = io->ring;
+    struct iovec *iov = &io->riov;
+    struct io_uring_sqe * sqe;
+    long usecs;
+
+    /* The read and its timeout must be submitted together. */
+    while (ring->sq_entries - (*ring->sq_tail
+		- __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) < 2)
+	(void) _UringEnter(io, 0);
+
+    (void) _DecSpace(&io->dec, iov);
+    sqe = _UringSqe(ring);
+    sqe->opcode = (ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ);
+    sqe->fd = io->fdno;
+    sqe->addr = (uintptr_t) iov->iov_base;
+    sqe->len = iov->iov_len;
+    sqe->off = (uint64_t) -1;
+    sqe->buf_index = 1;
+    sqe->user_data = _URING_READ;
+    ring->rpending = 1;
+    if (timed) {
+	sqe->flags = IOSQE_IO_LINK;
+	usecs = _Wait(io);
+	ring->ts.tv_sec = usecs / 1000000;
+	ring->ts.tv_nsec = (usecs % 1000000) * 1000;
+	sqe = _UringSqe(ring);
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t) &ring->ts;
+	sqe->len = 1;
+	sqe->user_data = _URING_TIMEOUT;
+    }
+    _UringPush(ring);
+}
+
+static ssize_t _UringReadv(IO_t io)
+{
+    URING_t ring = _UringGet(io);
+    ssize_t rc;
+
+    if (ring == NULL)
+	return io->Get(io);
+
+    if (!ring->rpending)
+	_UringQueueRead(io, 0);
+    while (ring->rpending && !exit_request) {
+	if (_UringEnter(io, 1) < 0 && errno != EINTR)
+	    break;
+	_UringReap(io);
+    }
+    ring->rdone = 0;
+
+    if (ring->rres < 0)
+	errno = -ring->rres;
+    rc = check(io, "<== uring read", &io->rtv,
+		_DecAdd(&io->dec, &io->riov, ring->rres));
+    return rc;
+}
+
+/*
+ * Wait for the next frame: one io_uring_enter() submits the receive (and
+ * its timeout) and reaps every completion that is ready.
+ */
+static ssize_t _UringPoll(IO_t io)
+{
+    URING_t ring = _UringGet(io);
+    struct iovec *iov = &io->riov;
+    int ntimeouts = 0;
+    ssize_t rc = -1;
+
+    if (ring == NULL)
+	return io->Chk(io);
+
+    while (!exit_request) {
+	/* Return a frame already buffered by a previous read. */
+	if (_DecGet(&io->dec, io->msgfmt, iov)) {
+	    rc = iov->iov_len;
+	    break;
+	}
+
+	if (!ring->rpending)
+	    _UringQueueRead(io, 1);
+	if (_UringEnter(io, 1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("io_uring_enter");
+	    exit_request = 1;
+	    break;
+	}
+	_UringReap(io);
+	if (!ring->rdone)
+	    continue;
+	ring->rdone = 0;
+
+	if (ring->rres == -ECANCELED) {
+	    if (_io_debug)
+fprintf(stderr, "    %s:\ttimeout\n", flbl(io));
+	    ntimeouts++;
+	    if (io->maxtimeouts > 0 && ntimeouts >= io->maxtimeouts) {
+		rc = 0;
+		break;
+	    }
+	    continue;
+	}
+	/* Partial frames wait for more bytes, extra frames are kept. */
+	if (ring->rres < 0)
+	    errno = -ring->rres;
+	rc = check(io, "<== uring read", &io->rtv,
+		_DecAdd(&io->dec, iov, ring->rres));
+	if (rc <= 0)
+	    break;
+    }
+    return rc;
+}
+#endif	/* __NR_io_uring_setup */
+
+#if defined(linux) && defined(__NR_memfd_create) && defined(__NR_futex)
+/*==============================================================*/
+/*
+ * Shared memory transport: the NUC and AVR exchange bytes through two
+ * single-producer/single-consumer rings in a memfd mapping. Neither side
+ * enters the kernel while its peer is busy; an idle consumer sleeps on a
+ * futex and only then does the producer pay for a FUTEX_WAKE.
+ */
+#define	_SHM_SPINS	100
+#if defined(__x86_64__) || defined(__i386__)
+#define	_ShmRelax()	__builtin_ia32_pause()
+#else
+#define	_ShmRelax()	__asm__ __volatile__("" ::: "memory")
+#endif
+
+/* The NUC (sv[0]) sends on r[0], the AVR (sv[1]) on r[1]. */
+#define	_ShmTx(_io)	(&(_io)->shm->r[(_io)->fdno == (_io)->sv[1]])
+#define	_ShmRx(_io)	(&(_io)->shm->r[(_io)->fdno != (_io)->sv[1]])
+
+static int _Shm(IO_t io)
+{
+    int rc = -1;	/* assume failure */
+    void * p;
+
+    io->sv[0] = check(io, "    memfd_create", NULL,
+		syscall(__NR_memfd_create, "turg", 0));
+    if (io->sv[0] < 0)
+	goto exit;
+    if (check(io, "    ftruncate", NULL,
+		ftruncate(io->sv[0], sizeof(*io->shm))) < 0)
+	goto exit;
+    p = mmap(NULL, sizeof(*io->shm), PROT_READ|PROT_WRITE, MAP_SHARED,
+		io->sv[0], 0);
+    if (p == MAP_FAILED) {
+	perror("mmap");
+	goto exit;
+    }
+    io->shm = p;
+    io->sv[1] = check(io, "    dup", NULL, dup(io->sv[0]));
+    if (io->sv[1] < 0)
+	goto exit;
+    rc = 0;
+
+exit:
+    (void) tstamp(&io->rtv);
+    io->wtv = io->rtv;		/* structure assignment */
+    return rc;
+}
+
+static int _ShmClose(IO_t io)
+{
+    if (io->shm) {
+	(void) munmap(io->shm, sizeof(*io->shm));
+	io->shm = NULL;
+    }
+    return _Close(io);
+}
+
+static ssize_t _ShmWritev(IO_t io)
+{
+    struct SHMRING_s * tx = _ShmTx(io);
+    struct iovec *iov = &io->wiov;
+    const uint8_t * s = iov->iov_base;
+    size_t ns = iov->iov_len;
+    uint32_t tail = tx->tail;
+    ssize_t rc;
+
+    while (ns > 0 && !exit_request) {
+	uint32_t head = __atomic_load_n(&tx->head, __ATOMIC_ACQUIRE);
+	size_t nfree = _SHM_RINGSZ - (tail - head);
+	size_t ix = tail & (_SHM_RINGSZ - 1);
+	size_t n = ns;
+
+	if (nfree == 0) {		/* full: the consumer is behind */
+	    (void) sched_yield();
+	    continue;
+	}
+	if (n > nfree)
+	    n = nfree;
+	if (n > _SHM_RINGSZ - ix)
+	    n = _SHM_RINGSZ - ix;
+	(void) memcpy(tx->b + ix, s, n);
+	s += n;
+	ns -= n;
+	tail += n;
+	__atomic_store_n(&tx->tail, tail, __ATOMIC_SEQ_CST);
+    }
+
+    /* Wake the consumer only if it went to sleep. */
+    if (__atomic_load_n(&tx->waiting, __ATOMIC_SEQ_CST)) {
+	__atomic_add_fetch(&tx->futex, 1, __ATOMIC_SEQ_CST);
+	(void) syscall(__NR_futex, &tx->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+	tx->nwake++;
+    }
+
+    rc = check(io, "<== shm write", &io->wtv, (ssize_t)(iov->iov_len - ns));
+    return rc;
+}
+
+/* Move whatever the peer has produced into the receive ring. */
+static ssize_t _ShmReadv(IO_t io)
+{
+    struct SHMRING_s * rx = _ShmRx(io);
+    struct iovec *iov = &io->riov;
+    uint32_t head = rx->head;
+    uint32_t tail = __atomic_load_n(&rx->tail, __ATOMIC_ACQUIRE);
+    size_t nb = _DecSpace(&io->dec, iov);
+    size_t n = 0;
+    ssize_t rc;
+
+    if (nb > tail - head)
+	nb = tail - head;
+    while (n < nb) {
+	size_t ix = (head + n) & (_SHM_RINGSZ - 1);
+	size_t nc = nb - n;
+	if (nc > _SHM_RINGSZ - ix)
+	    nc = _SHM_RINGSZ - ix;
+	(void) memcpy((uint8_t *)iov->iov_base + n, rx->b + ix, nc);
+	n += nc;
+    }
+    __atomic_store_n(&rx->head, head + n, __ATOMIC_RELEASE);
+
+    rc = check(io, "<== shm read", &io->rtv,
+		_DecAdd(&io->dec, iov, n));
+    return rc;
+}
+
+static ssize_t _ShmPoll(IO_t io)
+{
+    struct SHMRING_s * rx = _ShmRx(io);
+    struct iovec *iov = &io->riov;
+    struct timespec ts;
+    int ntimeouts = 0;
+    ssize_t rc = -1;
+
+    while (!exit_request) {
+	uint32_t seq;
+
+	/* Return a frame already buffered by a previous read. */
+	if (_DecGet(&io->dec, io->msgfmt, iov)) {
+	    rc = iov->iov_len;
+	    break;
+	}
+
+	/* Spin briefly: a busy peer answers without any syscall. */
+	for (int i = 0; i < _SHM_SPINS; i++) {
+	    if (__atomic_load_n(&rx->tail, __ATOMIC_ACQUIRE) != rx->head)
+		break;
+	    _ShmRelax();
+	}
+	if (__atomic_load_n(&rx->tail, __ATOMIC_ACQUIRE) != rx->head) {
+	    (void) io->Get(io);
+	    continue;
+	}
+
+	/* Sleep, re-checking after announcing so no wakeup is lost. */
+	seq = __atomic_load_n(&rx->futex, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&rx->waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&rx->tail, __ATOMIC_SEQ_CST) == rx->head) {
+	    (void) _Timeout(io, &ts);
+	    rx->nwait++;
+	    rc = syscall(__NR_futex, &rx->futex, FUTEX_WAIT, seq, &ts, NULL, 0);
+	    if (rc < 0 && errno == ETIMEDOUT) {
+		__atomic_store_n(&rx->waiting, 0, __ATOMIC_SEQ_CST);
+		if (_io_debug)
+fprintf(stderr, "    %s:\ttimeout\n", flbl(io));
+		ntimeouts++;
+		if (io->maxtimeouts > 0 && ntimeouts >= io->maxtimeouts) {
+		    rc = 0;
+		    break;
+		}
+		continue;
+	    }
+	}
+	__atomic_store_n(&rx->waiting, 0, __ATOMIC_SEQ_CST);
+    }
+    return rc;
+}
+#endif	/* __NR_memfd_create */
+
+/*==============================================================*/
+typedef struct MSG_s * MSG_t;
+struct MSG_s {
+    TID_t tid;
+    CMD_t cmd;
+    const char *pay;
+    size_t npay;
+};
 struct MSG_s msgs[] = {
 #ifdef	NOTNOW
   { TID_D2A,	CMD_ambient,	"\x05\x50", 2 },		/* d2a write */
@@ -1184,45 +3036,62 @@ static int _Parse(IO_t io, struct iovec *iov)
     io->val = 0xffff;
     io->retvalid = 0;
     io->retval = 0xffff;
+    io->nretb = 0;
 
     switch (io->msgfmt) {
     default:
     case 2:	/* === binary with start/stop flags. */
-	if (!(io->b[0] == TWIDDLE && io->b[io->nb-1] == TWIDDLE))
+	if (!(io->b[0] == TWIDDLE && io->b[io->nb-1] == TWIDDLE)) {
+	    io->dec.nframing++;
 	    goto exit;
+	}
 	io->bs++;
 	io->nb -= 2;
 	/*@fallthrough@*/
     case 1:	/* === binary without start/stop flags. */
-	if (io->bs[0] != (io->nb - 2))
+	if (io->bs[0] != (io->nb - 2)) {
+	    io->dec.nframing++;
 	    goto exit;
+	}
 	{
 	    uint16_t crc = 0xffff;
 	    crc = pppfcs(crc, io->bs, (io->nb - 2));
 	    if (io->bs[io->nb-2] != ((crc >> 8) & 0xFF)
-	     || io->bs[io->nb-1] != ((crc     ) & 0xFF))
+	     || io->bs[io->nb-1] != ((crc     ) & 0xFF)) {
+		io->dec.ncrc++;
 		goto exit;
+	    }
 	}
-	io->tid = io->bs[1];
-	io->cmd = io->bs[2];
-	if ((io->nb - 2) >= 5) {
-	    io->valid = 1;
-	    io->val = io->bs[3+0] << 8 | io->bs[3+1];
+	{   size_t h = 1;	/* header offset */
+	    if (io->window > 0)
+		io->seq = io->bs[h++];
+	    io->tid = io->bs[h+0];
+	    io->cmd = io->bs[h+1];
+	    io->bp = io->bs + h + 2;
+	    if ((io->nb - 2) >= h + 4) {
+		io->valid = 1;
+		io->val = io->bs[h+2+0] << 8 | io->bs[h+2+1];
+	    }
 	}
 	break;
     case 0:	/* === ascii/hex with CR/LF */
-	if (!(io->b[io->nb-2] == '\r' && io->b[io->nb-1] == '\n'))
+	if (!(io->b[io->nb-2] == '\r' && io->b[io->nb-1] == '\n')) {
+	    io->dec.nframing++;
 	    goto exit;
+	}
 	/* XXX CRC? */
 	io->tid = io->bs[0];
 	io->cmd = io->bs[1];
+	io->bp = io->bs + 2;
 	if ((io->nb - 2) >= 6) {
 	    io->valid = 1;
 	    io->val = 0;
 	    for (int i = 0; i < 4; i++) {
 		int c = io->bs[2+i];
-		if (!isxdigit(c))
+		if (!isxdigit(c)) {
+		    io->dec.nframing++;
 		    goto exit;
+		}
 		io->val <<= 4;
 		if (c >= '0' && c <= '9')
 		    io->val += c - '0';
@@ -1238,11 +3107,11 @@ static int _Parse(IO_t io, struct iovec *iov)
     rc = 0;
 
 exit:
-fprintf(stderr, "<== %s: rc %d\n", flbl(io), rc);
+    _Trace(io, TR_PARSE, rc, 0, 0);
     return rc;
 }
 
-static int _GetSet(IO_t io, const char *valname, uint16_t *vals)
+static int _GetSet(IO_t io, uint16_t *vals)
 {
     int ix = io->cmd;	/* io->cmd is the sensor index */
     int rc = -1;	/* assume failure */
@@ -1253,7 +3122,7 @@ static int _GetSet(IO_t io, const char *valname, uint16_t *vals)
     if (io->valid) {
 	/* Set/Save input value, return value in ACK msg. */
 	vals[io->cmd] = io->val;
-fprintf(stderr, "\t\t\t--> %s[%u] 0x%04X\n", valname, ix, vals[io->cmd]);
+	_Trace(io, TR_SET, 0, vals[ix], 0);
 	io->retvalid = 1;
 	io->retval = vals[ix];
     } else {
@@ -1272,25 +3141,623 @@ fprintf(stderr, "\t\t\t--> %s[%u] 0x%04X\n", valname, ix, vals[io->cmd]);
 		retval = 0x0fff;
 	    io->retval = retval;
 	}
-fprintf(stderr, "\t\t\t<-- %s[%u] 0x%04X\n", valname, ix, vals[io->cmd]);
+	_Trace(io, TR_GET, 0, vals[ix], 0);
     }
     rc = 0;
 
 exit:
-fprintf(stderr, "<== %s: rc %d\n", flbl(io), rc);
+    _Trace(io, TR_GETSET, rc, 0, 0);
     return rc;
 }
 
-static int _Process(IO_t io)
+/*==============================================================*/
+static void _StatReset(STAT_t st)
 {
-    int ix;
-    int rc = -1;	/* assume failure */
+    memset(st, 0, sizeof(*st));
+}
 
-    switch (io->tid) {
-    default:
+static void _StatAdd(STAT_t st, FLOAT_t x)
+{
+    if (st->n++ == 0) {
+	st->min = x;
+	st->max = x;
+    }
+    st->sum += x;
+    st->sumsq += (int64_t) x * x;
+    if (x < st->min)
+	st->min = x;
+    if (x > st->max)
+	st->max = x;
+}
+
+/* Combine partial b into st. */
+static void _StatMerge(STAT_t st, const struct STAT_s *b)
+{
+    if (b->n == 0)
+	return;
+    if (st->n == 0) {
+	*st = *b;	/* structure assignment */
+	return;
+    }
+    st->n += b->n;
+    st->sum += b->sum;
+    st->sumsq += b->sumsq;
+    if (b->min < st->min)
+	st->min = b->min;
+    if (b->max > st->max)
+	st->max = b->max;
+}
+
+static FLOAT_t _StatMean(const struct STAT_s *st)
+{
+    return (st->n ? (FLOAT_t) llround((double) st->sum / st->n) : 0);
+}
+
+/* Sum of squared deviations from the mean: (n * sumsq - sum^2) / n. */
+static double _StatM2(const struct STAT_s *st)
+{
+    if (st->n == 0)
+	return 0;
+    return (double) ((__int128) st->n * st->sumsq
+		- (__int128) st->sum * st->sum) / st->n;
+}
+
+/* Sample standard deviation (in FLOAT_t units). */
+static FLOAT_t _StatStddev(const struct STAT_s *st)
+{
+    return (st->n > 1 ? (FLOAT_t) llround(sqrt(_StatM2(st) / (st->n - 1))) : 0);
+}
+
+/*==============================================================*/
+/* Scale and accumulate the raw codes of the lanes in mask, one at a time. */
+static void _BankSweepC(BANK_t b, const uint16_t *raw, uint32_t mask)
+{
+    for (int i = 0; i < _BANK_NLANES; i++) {
+	FLOAT_t x;
+	int64_t d;
+	if (!(mask & (1U << i)))
+	    continue;
+	if (b->lutmask & (1U << i))
+	    x = b->lut[i * _LUT_NCODES + (raw[i] < _LUT_NCODES ? raw[i] : _LUT_NCODES - 1)];
+	else
+	    x = b->gain[i] * raw[i] + b->off[i];
+	if (!(b->seen & (1U << i))) {
+	    b->k[i] = x;
+	    b->min[i] = x;
+	    b->max[i] = x;
+	}
+	d = (int64_t) x - b->k[i];
+	b->n[i]++;
+	b->s1[i] += d;
+	b->s2[i] += (double) d * d;
+	if (x < b->min[i])
+	    b->min[i] = x;
+	if (x > b->max[i])
+	    b->max[i] = x;
+    }
+    b->seen |= mask;
+}
+
+#if defined(__x86_64__)
+/*
+ * The same, all 8 lanes at once (bit-identical to _BankSweepC). The loads
+ * and stores are unaligned: a URG_s is allocated with xmalloc().
+ */
+__attribute__((target("avx2")))
+static void _BankSweepAVX2(BANK_t b, const uint16_t *raw, uint32_t mask)
+{
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), bit), bit);
+    __m256i f = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask & ~b->seen), bit), bit);
+    __m256i r = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) raw));
+    __m256i x = _mm256_add_epi32(
+		_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *) b->gain), r),
+		_mm256_loadu_si256((const __m256i *) b->off));
+
+    /* Tabled lanes: one gather from lut[lane][code]. */
+    if (b->lutmask & mask) {
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i t = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(b->lutmask & mask), bit), bit);
+	__m256i ix = _mm256_add_epi32(_mm256_min_epu32(r, _mm256_set1_epi32(_LUT_NCODES - 1)),
+		_mm256_mullo_epi32(lane, _mm256_set1_epi32(_LUT_NCODES)));
+	x = _mm256_mask_i32gather_epi32(x, (const int *) b->lut, ix, t, 4);
+    }
+    __m256i k = _mm256_blendv_epi8(_mm256_loadu_si256((const __m256i *) b->k), x, f);
+    __m256i lo = _mm256_blendv_epi8(_mm256_loadu_si256((const __m256i *) b->min), x, f);
+    __m256i hi = _mm256_blendv_epi8(_mm256_loadu_si256((const __m256i *) b->max), x, f);
+
+    lo = _mm256_blendv_epi8(lo, _mm256_min_epi32(lo, x), m);
+    hi = _mm256_blendv_epi8(hi, _mm256_max_epi32(hi, x), m);
+    _mm256_storeu_si256((__m256i *) b->k, k);
+    _mm256_storeu_si256((__m256i *) b->min, lo);
+    _mm256_storeu_si256((__m256i *) b->max, hi);
+
+    /* Widen to 2 x 4 lanes: n and s1 are int64, s2 is double. */
+    for (int h = 0; h < 2; h++) {
+	__m128i x4 = (h ? _mm256_extracti128_si256(x, 1) : _mm256_castsi256_si128(x));
+	__m128i k4 = (h ? _mm256_extracti128_si256(k, 1) : _mm256_castsi256_si128(k));
+	__m128i m4 = (h ? _mm256_extracti128_si256(m, 1) : _mm256_castsi256_si128(m));
+	__m256i m64 = _mm256_cvtepi32_epi64(m4);		/* 0 or -1 */
+	__m256i d64 = _mm256_sub_epi64(_mm256_cvtepi32_epi64(x4), _mm256_cvtepi32_epi64(k4));
+	__m256d d = _mm256_sub_pd(_mm256_cvtepi32_pd(x4), _mm256_cvtepi32_pd(k4));
+	__m256i *n = (__m256i *) (b->n + 4 * h);
+	__m256i *s1 = (__m256i *) (b->s1 + 4 * h);
+	double *s2 = b->s2 + 4 * h;
+
+	_mm256_storeu_si256(n, _mm256_sub_epi64(_mm256_loadu_si256(n), m64));
+	_mm256_storeu_si256(s1, _mm256_add_epi64(_mm256_loadu_si256(s1),
+		_mm256_and_si256(d64, m64)));
+	_mm256_storeu_pd(s2, _mm256_add_pd(_mm256_loadu_pd(s2),
+		_mm256_and_pd(_mm256_mul_pd(d, d), _mm256_castsi256_pd(m64))));
+    }
+    b->seen |= mask;
+}
+#endif	/* __x86_64__ */
+
+static void (*_bank_sweep) (BANK_t b, const uint16_t *raw, uint32_t mask)
+	= _BankSweepC;
+
+/*
+ * Resolve the sweep kernel. Call once from main(), next to pppfcs_init(),
+ * before any thread or fork.
+ */
+static void _BankSweepInit(void)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+	_bank_sweep = _BankSweepAVX2;
+#endif
+}
+
+/* Sweep the staged codes, then merge the lanes into the sensor stats. */
+static void _BankFlush(URG_t urg)
+{
+    struct SENSOR_s *sensors = &urg->sensor;
+    BANK_t b = &urg->bank;
+
+    if (b->pending) {
+	(*_bank_sweep) (b, b->raw, b->pending);
+	b->pending = 0;
+    }
+    for (int i = 0; i < _NSENSORS; i++) {
+	struct STAT_s part;
+	if (b->n[i] == 0)
+	    continue;
+	/* Unshift: x = k + d, so sum x^2 = s2 + 2k s1 + n k^2. */
+	part.n = b->n[i];
+	part.min = b->min[i];
+	part.max = b->max[i];
+	part.sum = (int64_t) b->k[i] * b->n[i] + b->s1[i];
+	part.sumsq = (__int128) b->s2[i]
+		+ (__int128) 2 * b->k[i] * b->s1[i]
+		+ (__int128) b->n[i] * ((int64_t) b->k[i] * b->k[i]);
+	_StatMerge(&sensors[i].stat, &part);
+	b->n[i] = 0;
+	b->s1[i] = 0;
+	b->s2[i] = 0;
+    }
+    b->seen = 0;
+}
+
+/* Flush, then take the (re)calibrated gain and offset of every sensor. */
+static void _BankLoad(URG_t urg)
+{
+    struct SENSOR_s *sensors = &urg->sensor;
+    BANK_t b = &urg->bank;
+
+    _BankFlush(urg);
+    for (int i = 0; i < _NSENSORS; i++) {
+	b->gain[i] = sensors[i].gain;
+	b->off[i] = sensors[i].off;
+    }
+    b->loaded = 1;
+}
+
+/*
+ * Stage a raw A2D code for sensor ix. A full sweep (or a second code for
+ * a lane already staged) is scaled and accumulated in one call.
+ */
+static void _SensorPut(URG_t urg, int ix, uint16_t rval)
+{
+    BANK_t b = &urg->bank;
+    uint32_t bit = (1U << ix);
+
+    if (!b->loaded)
+	_BankLoad(urg);
+    if (b->pending & bit) {
+	(*_bank_sweep) (b, b->raw, b->pending);
+	b->pending = 0;
+    }
+    b->raw[ix] = rval;
+    b->pending |= bit;
+    if (b->pending == (1U << _NSENSORS) - 1) {
+	(*_bank_sweep) (b, b->raw, b->pending);
+	b->pending = 0;
+    }
+    if (b->n[ix] >= _BANK_NFLUSH)
+	_BankFlush(urg);
+}
+
+/* Start a new measurement of sensor ix (e.g. after changing its gain). */
+static void _SensorReset(URG_t urg, int ix)
+{
+    struct SENSOR_s *sensors = &urg->sensor;
+
+    _BankLoad(urg);
+    _StatReset(&sensors[ix].stat);
+}
+
+/* Clamp a scaled value to the FLOAT_t range. */
+static FLOAT_t _SensorSat(int64_t x)
+{
+    return (x < INT32_MIN ? INT32_MIN : x > INT32_MAX ? INT32_MAX : (FLOAT_t) x);
+}
+
+/*
+ * Build the code to value table of sensor ix: the linear calibration,
+ * corrected piecewise-linearly through the (sys, ref) points measured.
+ * The two-point calibration is exact at codes 0 and rmax, so those are
+ * knots with no correction. Beyond the outer knots the correction is held.
+ * Codes past rmax (a 10-bit sensor) read as rmax. Values saturate to the
+ * FLOAT_t range: a large calibrated gain must not overflow.
+ */
+static void _SensorLUT(URG_t urg, int ix, const FLOAT_t *sys, const FLOAT_t *ref, int nref)
+{
+    struct SENSOR_s *sensors = &urg->sensor;
+    struct SENSOR_s *sensor = sensors + ix;
+    BANK_t b = &urg->bank;
+    FLOAT_t kx[2 + 6];
+    double kc[2 + 6];	/* correction (ref - sys) at kx[] */
+    FLOAT_t *lut;
+    int nk = 0;
+    int code;
+
+    if (sensor->rmax >= _LUT_NCODES || nref > 6)
+	return;
+    if (b->lut == NULL)
+	b->lut = xcalloc(_BANK_NLANES * _LUT_NCODES, sizeof(*b->lut));
+    lut = b->lut + ix * _LUT_NCODES;
+
+    kx[nk] = sensor->off;			kc[nk++] = 0;
+    kx[nk] = _SensorSat((int64_t) sensor->gain * sensor->rmax + sensor->off);	kc[nk++] = 0;
+    for (int j = 0; j < nref; j++) {
+	kx[nk] = sys[j];
+	kc[nk++] = ref[j] - sys[j];
+    }
+    /* Sort the knots (there are only a few). */
+    for (int i = 1; i < nk; i++) {
+	for (int j = i; j > 0 && kx[j] < kx[j-1]; j--) {
+	    FLOAT_t tx = kx[j];	kx[j] = kx[j-1];	kx[j-1] = tx;
+	    double tc = kc[j];	kc[j] = kc[j-1];	kc[j-1] = tc;
+	}
+    }
+
+    for (code = 0; code <= sensor->rmax; code++) {
+	FLOAT_t x = _SensorSat((int64_t) sensor->gain * code + sensor->off);
+	double c;
+	int j = 0;
+	while (j < nk - 1 && kx[j+1] <= x)
+	    j++;
+	if (x <= kx[0])
+	    c = kc[0];
+	else if (j == nk - 1)
+	    c = kc[nk-1];
+	else
+	    c = kc[j] + (kc[j+1] - kc[j]) * (x - kx[j]) / (kx[j+1] - kx[j]);
+	lut[code] = _SensorSat((int64_t) x + llround(c));
+    }
+    for (; code < _LUT_NCODES; code++)
+	lut[code] = lut[sensor->rmax];
+    b->lutmask |= (1U << ix);
+}
+
+/* Copy a device's state: the copy converts through a LUT of its own. */
+static URG_t _UrgDup(URG_t urg)
+{
+    URG_t nurg = memcpy(xmalloc(sizeof(*nurg)), urg, sizeof(*nurg));
+    size_t nb = _BANK_NLANES * _LUT_NCODES * sizeof(*urg->bank.lut);
+
+    if (urg->bank.lut)
+	nurg->bank.lut = memcpy(xmalloc(nb), urg->bank.lut, nb);
+    return nurg;
+}
+
+/* Free a device's state (only the LUT of the static _urg). */
+static URG_t _UrgFree(URG_t urg)
+{
+    if (urg) {
+	free(urg->bank.lut);
+	urg->bank.lut = NULL;
+	urg->bank.lutmask = 0;
+	if (urg != &_urg)
+	    free(urg);
+    }
+    return NULL;
+}
+
+/* Fill in the fields derived from a sensor's statistics. */
+static void _SensorSync(struct SENSOR_s *sensor)
+{
+    STAT_t st = &sensor->stat;
+    int64_t sum = st->sum;
+
+    if (st->n == 0)
+	return;
+    sensor->npts = (st->n < UINT16_MAX ? st->n : UINT16_MAX);
+    sensor->sum = (sum > INT32_MAX ? INT32_MAX
+			: sum < INT32_MIN ? INT32_MIN : (FLOAT_t) sum);
+    sensor->avg = _StatMean(st);
+    sensor->min = st->min;
+    sensor->max = st->max;
+}
+
+/* Derive the sensor fields, the ambient temperature and pressure and the flow CV. */
+static void _SensorStats(URG_t urg)
+{
+    struct SENSOR_s *sensors = &urg->sensor;
+    STAT_t st = &urg->flow_sensor.stat;
+
+    _BankFlush(urg);
+    for (int i = 0; i < _NSENSORS; i++)
+	_SensorSync(sensors + i);
+    if (urg->ambient.npts > 0)
+	urg->temp = urg->ambient.avg;
+    if (urg->barometer.npts > 0)
+	urg->pres = urg->barometer.avg;
+    if (st->n > 1 && _StatMean(st) != 0)
+	urg->flow_CV = _F2I((double) _StatStddev(st) / _StatMean(st));
+}
+
+/*
+ * Verify the sweep kernels agree bit for bit (with and without tables),
+ * and time them over n sweeps. The table rows apply the piecewise
+ * correction of _SensorLUT(), so compare them with each other, not with
+ * the linear rows.
+ */
+static int _DoBank(size_t n)
+{
+    static const struct {
+	const char *name;
+	void (*sweep) (BANK_t b, const uint16_t *raw, uint32_t mask);
+    } engines[] = {
+	{ "C",		_BankSweepC },
+#if defined(__x86_64__)
+	{ "avx2",	_BankSweepAVX2 },
+#endif
+    };
+    size_t nengines = (sizeof(engines)/sizeof(engines[0]));
+    static struct BANK_s banks[sizeof(engines)/sizeof(engines[0])];
+    static const uint32_t lutmasks[] = { 0x00, 0xff };
+    FLOAT_t *lut = xmalloc(_BANK_NLANES * _LUT_NCODES * sizeof(*lut));
+    uint16_t *raw = xmalloc(n * _BANK_NLANES * sizeof(*raw));
+    uint32_t *masks = xmalloc(n * sizeof(*masks));
+    struct STAT_s stats[_BANK_NLANES];
+    uint64_t t0, t1;
+    int rc = 0;
+
+    for (size_t i = 0; i < n * _BANK_NLANES; i++)
+	raw[i] = random() & 0x0fff;
+    for (size_t i = 0; i < n; i++)	/* mostly full sweeps */
+	masks[i] = (random() % 4 ? 0xff : random() & 0xff);
+    for (size_t i = 0; i < _BANK_NLANES * _LUT_NCODES; i++)
+	lut[i] = random() % _F2I(1000.) - _F2I(500.);
+    for (size_t j = 0; j < nengines; j++) {
+	srandom(1);
+	for (int i = 0; i < _BANK_NLANES; i++) {
+	    banks[j].gain[i] = random() % _F2I(0.6);
+	    banks[j].off[i] = random() % _F2I(1000.) - _F2I(500.);
+	}
+	banks[j].lut = lut;
+	banks[j].lutmask = 0x5a;	/* mixed lanes */
+    }
+
+    for (size_t j = 1; j < nengines; j++) {
+#if defined(__x86_64__)
+	if (engines[j].sweep == _BankSweepAVX2 && _bank_sweep != _BankSweepAVX2)
+	    continue;
+#endif
+	for (size_t i = 0; i < n; i++) {
+	    _BankSweepC(banks, raw + i * _BANK_NLANES, masks[i]);
+	    engines[j].sweep(banks + j, raw + i * _BANK_NLANES, masks[i]);
+	}
+	if (memcmp(banks, banks + j, sizeof(*banks))) {
+	    fprintf(stderr, "*** %s: %s differs from C\n", __FUNCTION__, engines[j].name);
+	    rc = -1;
+	}
+    }
+
+    fprintf(stderr, "%8s %10s", "scaling", "_StatAdd");
+    for (size_t j = 0; j < nengines; j++)
+	fprintf(stderr, " %10s", engines[j].name);
+    fprintf(stderr, "\t(%s/sweep of %d, %zu sweeps)\n",
+#if defined(__x86_64__)
+		"cycles",
+#else
+		"nsecs",
+#endif
+		_BANK_NLANES, n);
+
+    for (size_t m = 0; m < sizeof(lutmasks)/sizeof(lutmasks[0]); m++) {
+	fprintf(stderr, "%8s", (lutmasks[m] ? "table" : "linear"));
+
+	/* Per-sample scaling and accumulation, as _Process used to do. */
+	memset(stats, 0, sizeof(stats));
+	t0 = _cycles();
+	for (size_t i = 0; i < n; i++) {
+	    const uint16_t *r = raw + i * _BANK_NLANES;
+	    for (int k = 0; k < _BANK_NLANES; k++)
+		_StatAdd(stats + k, (lutmasks[m]
+			? lut[k * _LUT_NCODES + r[k]]
+			: banks->gain[k] * r[k] + banks->off[k]));
+	}
+	t1 = _cycles();
+	fprintf(stderr, " %10.2f", (double)(t1 - t0) / n);
+
+	for (size_t j = 0; j < nengines; j++) {
+#if defined(__x86_64__)
+	    if (engines[j].sweep == _BankSweepAVX2 && _bank_sweep != _BankSweepAVX2) {
+		fprintf(stderr, " %10s", "-");
+		continue;
+	    }
+#endif
+	    banks[j].lutmask = lutmasks[m];
+	    t0 = _cycles();
+	    for (size_t i = 0; i < n; i++)
+		engines[j].sweep(banks + j, raw + i * _BANK_NLANES, 0xff);
+	    t1 = _cycles();
+	    fprintf(stderr, " %10.2f", (double)(t1 - t0) / n);
+	}
+	fprintf(stderr, "\n");
+    }
+
+    free(masks);
+    free(raw);
+    free(lut);
+    return rc;
+}
+
+/*==============================================================*/
+/*
+ * A TID_BATCH request carries CMD = n followed by n (TID, CMD, npay, pay)
+ * tuples. The response carries n packed (TID, CMD, val_hi, val_lo) results,
+ * with CMD_NAK set on items that failed. Every item is run through
+ * _Process(), on the AVR to execute it, on the NUC to apply it. The NUC
+ * applies nothing unless every item was ACKed: a NAKed item resends the
+ * whole batch, whose samples must not be accumulated twice.
+ *
+ * The results must fit in retb[] and in one response frame: a batch of
+ * more items than that fails (and is NAKed) as a whole.
+ */
+static int _Process(IO_t io);
+
+/* Overhead of a msgfmt 2 frame with sequence byte: ~ n seq tid cmd crc crc ~ */
+#define	_FRAME_OVERHEAD	8
+#define	_BATCH_NMAX	((MSGBUFLEN - _FRAME_OVERHEAD) / 4)
+
+static int _Batch(IO_t io)
+{
+    int avr = !strcmp(io->role, "avr");
+    const uint8_t * b = io->bp;
+    const uint8_t * be = io->be;
+    uint8_t * t = io->retb;
+    int n = io->cmd;
+    int nfail = 0;
+    int rc = -1;	/* assume failure */
+
+    if (n > _BATCH_NMAX)
+	goto exit;
+
+    if (!avr) {
+	for (int i = 0; i < n; i++) {
+	    const uint8_t * r = b + 4 * i;
+	    if (r + 4 > be)
+		goto exit;
+	    if (r[0] == TID_BATCH || (r[1] & CMD_NAK))
+		nfail++;
+	}
+	if (nfail)
+	    goto exit;
+    }
+
+    for (int i = 0; i < n; i++) {
+	if (b + (avr ? 3 : 4) > be)
+	    goto exit;
+	io->tid = b[0];
+	io->cmd = b[1];
+	io->retvalid = 0;
+	io->retval = 0xffff;
+	if (avr) {
+	    size_t npay = b[2];
+	    b += 3;
+	    if (b + npay > be)
+		goto exit;
+	    io->valid = (npay >= 2);
+	    io->val = (io->valid ? (b[0] << 8 | b[1]) : 0xffff);
+	    b += npay;
+	} else {
+	    io->valid = 1;
+	    io->val = b[2] << 8 | b[3];
+	    b += 4;
+	}
+
+	if (io->tid == TID_BATCH || (io->cmd & CMD_NAK) || _Process(io)) {
+	    io->cmd |= CMD_NAK;
+	    io->retvalid = 0;
+	    nfail++;
+	}
+	if (!io->retvalid)
+	    io->retval = io->val;
+	*t++ = io->tid;
+	*t++ = io->cmd;
+	*t++ = ((io->retval >> 8) & 0xFF);
+	*t++ = ((io->retval     ) & 0xFF);
+    }
+    io->nretb = t - io->retb;
+    io->retvalid = 0;
+
+    /* Item failures are reported in the results, not retried. */
+    rc = 0;
+
+exit:
+    io->tid = TID_BATCH;
+    io->cmd = n;
+    _Trace(io, TR_BATCH, rc, n, nfail);
+    return rc;
+}
+
+/*
+ * Push subscription: (TID_A2D, CMD_ON) carries the interval in msecs as
+ * its value, then a 32 bit mask of the A2D channels. The emulator then
+ * sends an unsolicited (TID_A2D, CMD_PUSH|index) sample per channel each
+ * interval. (TID_A2D, CMD_OFF) or a 0 interval stops the pushes.
+ */
+static int _PushSet(IO_t io)
+{
+    int rc = -1;	/* assume failure */
+
+    if (strcmp(io->role, "avr")) {	/* the NUC sees the ACK */
+	rc = 0;
+	goto exit;
+    }
+    if (io->cmd == CMD_ON && io->valid && io->val > 0) {
+	const uint8_t *b = io->bp + 2;
+	if (io->be - b < 4)
+	    goto exit;
+	io->pushmask = (uint32_t) b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+	io->pushival = 1000L * io->val;
+	(void) tstamp(&io->pushtv);
+    } else {
+	io->pushmask = 0;
+	io->pushival = 0;
+    }
+    io->retvalid = 1;
+    io->retval = io->pushmask & 0xffff;
+    rc = 0;
+
+exit:
+    return rc;
+}
+
+static int _Process(IO_t io)
+{
+    URG_t urg = io->urg;
+    int ix;
+    int rc = -1;	/* assume failure */
+
+    switch (io->tid) {
+    default:
 	goto exit;
     case TID_A2D:	/* RDONLY */
-	if (_GetSet(io, " A2D", io->ADvals))
+	if (io->cmd == CMD_ON || io->cmd == CMD_OFF) {
+	    if (_PushSet(io))
+		goto exit;
+	    break;
+	}
+	if (_CMD_ISPUSH(io->cmd)) {	/* a pushed sample reads as a response */
+	    io->cmd &= ~CMD_PUSH;
+	    io->npush++;
+	}
+	if (_GetSet(io, io->ADvals))
 	    goto exit;
 	/* XXX set time stamp? */
 
@@ -1304,37 +3771,19 @@ static int _Process(IO_t io)
 	    sensor->tstamp = *tvp;	/* structure assignment */
 	    if (io->retvalid) {
 		uint16_t rval = io->retval;
-		FLOAT_t sval;
 		sensor->rval = rval;
 		/* XXX Convert units here? */
-		sval = sensor->gain * rval + sensor->off;
-		sensor->npts++;
-		sensor->sum = sensor->sum + sval;
-		sensor->avg = sensor->sum/sensor->npts;
-		if (sval > sensor->max)
-		    sensor->max = sval;
-		if (sval < sensor->min)
-		    sensor->min = sval;
-
-		/* XXX Fill in fields that are not sensor calculated. */
-		if (sensor == &urg->ambient)
-		    urg->temp = sensor->avg;
-		if (sensor == &urg->barometer)
-		    urg->pres = sensor->avg;
-
-#ifdef	NOTNOW
-fprintf(stderr, "*** %s: sval %6.1f npts %u sum %10.3f min %6.1f avg %6.1f max %6.1f\n", __FUNCTION__, _I2F(sval), sensor->npts, _I2F(sensor->sum), _I2F(sensor->min), _I2F(sensor->avg), _I2F(sensor->max));
-#endif
+		_SensorPut(urg, ix, rval);
 	    }
 	}
 	break;
     case TID_D2A:	/* WRONLY */
-	if (_GetSet(io, " D2A", io->ADvals))
+	if (_GetSet(io, io->ADvals))
 	    goto exit;
 	/* XXX set time stamp? */
 	break;
     case TID_DIO:
-	if (_GetSet(io, " DIO", io->Fvals))
+	if (_GetSet(io, io->Fvals))
 	    goto exit;
 	io->retvalid = 1;
 	/* XXX set time stamp? */
@@ -1353,7 +3802,7 @@ fprintf(stderr, "*** %s: sval %6.1f npts %u sum %10.3f min %6.1f avg %6.1f max %
 	}
 	break;
     case TID_PRES:	/* RDONLY */
-	if (_GetSet(io, "PRES", io->Pvals))
+	if (_GetSet(io, io->Pvals))
 	    goto exit;
 	/* XXX set time stamp? */
 	break;
@@ -1367,17 +3816,21 @@ fprintf(stderr, "*** %s: sval %6.1f npts %u sum %10.3f min %6.1f avg %6.1f max %
 	}
 	break;
     case TID_TEMP:	/* RDONLY */
-	if (_GetSet(io, "TEMP", io->Tvals))
+	if (_GetSet(io, io->Tvals))
 	    goto exit;
 	/* XXX set time stamp? */
 	break;
+    case TID_BATCH:
+	if (io->msgfmt == 0 || _Batch(io))
+	    goto exit;
+	break;
     case TID_GLOBAL:
 	/* XXX set time stamp? */
 	switch (io->cmd) {
 	default:
 	    goto exit;
 	case CMD_QUIT:
-	    exit_request = 1;
+	    io->quit = 1;
 	    break;
 	}
 	break;
@@ -1385,24 +3838,91 @@ fprintf(stderr, "*** %s: sval %6.1f npts %u sum %10.3f min %6.1f avg %6.1f max %
     rc = 0;
 
 exit:
-fprintf(stderr, "<== %s: rc %d\n", flbl(io), rc);
+    _Trace(io, TR_PROCESS, rc, 0, 0);
     return rc;
 }
 
 /*==============================================================*/
+/* Apply the emulated response delay and error rates. Returns -1 to drop. */
+static int _Emulate(IO_t io)
+{
+    struct iovec *iov = &io->wiov;
+    unsigned usecs = io->delay;
+
+    if (io->jitter > 0)
+	usecs += rand_r(&io->seed) % io->jitter;
+    if (usecs > 0) {
+	struct timespec ts = { usecs / 1000000, 1000 * (usecs % 1000000) };
+	(void) nanosleep(&ts, NULL);
+    }
+    if (io->pdrop > 0 && (int)(rand_r(&io->seed) % 100) < io->pdrop)
+	return -1;
+    if (io->pcorrupt > 0 && (int)(rand_r(&io->seed) % 100) < io->pcorrupt
+     && iov->iov_len > 0)
+	((uint8_t *)iov->iov_base)[rand_r(&io->seed) % iov->iov_len] ^= 0x5a;
+    return 0;
+}
+
+/* Send the pushed samples when due: the emulator's sampling clock. */
+static int _Publish(IO_t io)
+{
+    static struct iovec ziov;	/* empty iovec */
+    struct iovec *iov = &io->wiov;
+    struct timeval ival = { io->pushival / 1000000, io->pushival % 1000000 };
+    struct timeval now;
+    int rc = 0;
+
+    if (io->pushival <= 0)
+	return 0;
+    (void) tstamp(&now);
+    if (timercmp(&now, &io->pushtv, <))
+	return 0;
+
+    for (int ix = 0; ix < _CMD_NDEVS; ix++) {
+	uint8_t s[2];
+	if (!(io->pushmask & (1U << ix)))
+	    continue;
+	/* Read the channel as a (noisy) A2D read would. */
+	io->tid = TID_A2D;
+	io->cmd = ix;
+	io->valid = 0;
+	if (_GetSet(io, io->ADvals))
+	    continue;
+	s[0] = ((io->retval >> 8) & 0xFF);
+	s[1] = ((io->retval     ) & 0xFF);
+	(void) _Load(io, TID_A2D, CMD_PUSH | ix, s, sizeof(s), iov);
+	if (io->Set(io) < 0)
+	    rc = -1;
+	iov->iov_base = _BufPut(io, iov->iov_base);
+	*iov = ziov;	/* structure assignment */
+	io->npush++;
+    }
+
+    /* Keep the period, but skip (rather than burst) pushes missed. */
+    timeradd(&io->pushtv, &ival, &io->pushtv);
+    if (timercmp(&io->pushtv, &now, <))
+	timeradd(&now, &ival, &io->pushtv);
+    return rc;
+}
+
 static int _Child(IO_t io)
 {
     static struct iovec ziov;	/* empty iovec */
     struct iovec *iov;
     int rc = 0;
 
-fprintf(stderr, "==> %s\n", flbl(io));
+    _Trace(io, TR_CHILD, 0, 0, 0);
 
     do {
-	/* Read message. */
+	/* Push any samples due, then read message. */
+	(void) _Publish(io);
 	rc = io->Chk(io);
-	if (rc < 0)
+	if (rc < 0 || io->dec.eof)
 	    break;
+	if (rc == 0) {		/* idle: nothing to answer */
+	    _DecStall(&io->dec);
+	    continue;
+	}
 
 	/* Prepare to receive another input message. */
 	io->wiov = io->riov;	/* structure assignment */
@@ -1422,11 +3942,12 @@ fprintf(stderr, "==> %s\n", flbl(io));
 	    io->retvalid = 0;
 	}
 
-	if (iov->iov_base)
-	    free(iov->iov_base);
+	iov->iov_base = _BufPut(io, iov->iov_base);
 	*iov = ziov;	/* structure assignment */
 
-	if (io->retvalid) {
+	if (io->nretb > 0) {
+	    rc = _Load(io, io->tid, io->cmd, io->retb, io->nretb, iov);
+	} else if (io->retvalid) {
 	    uint8_t s[2];
 	    size_t ns = sizeof(s);
 	    s[0] = ((io->retval >> 8) & 0xFF);
@@ -1436,178 +3957,1171 @@ fprintf(stderr, "==> %s\n", flbl(io));
 	    rc = _Load(io, io->tid, io->cmd, NULL, 0, iov);
 	}
 
-	/* Send response. */
-	rc = io->Set(io);
+	/* Send response (unless the emulated device loses it). */
+	if (_Emulate(io) == 0)
+	    rc = io->Set(io);
 
 	/* Cleanup. */
-	if (iov->iov_base)
-	    free(iov->iov_base);
+	iov->iov_base = _BufPut(io, iov->iov_base);
 	io->wiov = ziov;	/* structure assignment */
 	rc = 0;		/* XXX just in case. */
 
-    } while (!exit_request);
+    } while (!exit_request && !io->quit);
 
     iov = &io->riov;
-    if (iov->iov_base)
-	free(iov->iov_base);
+    iov->iov_base = _BufPut(io, iov->iov_base);
     *iov = ziov;	/* structure assignment */
     iov = &io->wiov;
-    if (iov->iov_base)
-	free(iov->iov_base);
+    iov->iov_base = _BufPut(io, iov->iov_base);
     *iov = ziov;	/* structure assignment */
+    if (_io_debug)
+fprintf(stderr, "    %s:\tbuffers %zu heap %zu\n", flbl(io), io->pool.nget, io->pool.nheap);
+    if (_io_debug && io->npush)
+fprintf(stderr, "    %s:\tpushed %zu samples\n", flbl(io), io->npush);
+#if defined(linux) && defined(__NR_io_uring_setup)
+    if (io->ring) {
+	if (_io_debug)
+fprintf(stderr, "    %s:\turing enters %zu\n", flbl(io), io->ring->nenter);
+	io->ring = _UringFree(io->ring);
+    }
+#endif
+#if defined(linux) && defined(__NR_memfd_create) && defined(__NR_futex)
+    if (_io_debug && io->shm)
+fprintf(stderr, "    %s:\tshm waits %zu wakes %zu\n", flbl(io), _ShmRx(io)->nwait, _ShmTx(io)->nwake);
+#endif
 fprintf(stderr, "<== %s: rc %d\n", flbl(io), rc);
     return rc;
 }
 
 /*==============================================================*/
+static double _Elapsed(struct timeval *t0, struct timeval *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_usec - t0->tv_usec) / 1.0e6;
+}
+
+#define	_RTO_MIN	2000	/* usecs, absorbs scheduling jitter */
+#define	_RTO_BACKOFF	1	/* doublings a timeout passes on to later commands */
+
+/*
+ * Fold a round trip (usecs) into the link's smoothed RTT and variation
+ * and derive the response timeout from them, as TCP does (RFC 6298),
+ * clamped between _RTO_MIN and the configured timeout.
+ */
+static void _Rtt(IO_t io, long r)
+{
+    long rto;
+
+    if (r < 0)		/* frame was read before the command was sent */
+	return;
+    if (io->nrtt++ == 0) {
+	io->srtt = r;
+	io->rttvar = r / 2;
+    } else {
+	long d = (io->srtt > r ? io->srtt - r : r - io->srtt);
+	io->rttvar += (d - io->rttvar) / 4;
+	io->srtt += (r - io->srtt) / 8;
+    }
+    rto = io->srtt + 4 * io->rttvar;
+    if (rto < _RTO_MIN)
+	rto = _RTO_MIN;
+    if (rto > 1000L * io->timeout)
+	rto = 1000L * io->timeout;
+    io->rto = rto;
+    io->backoff = 0;	/* a fresh sample collapses the backoff (RFC 6298 5.7) */
+}
+
+/*
+ * The timeout of a command sent now: the link's RTO, doubled if a command
+ * timed out since the last RTT sample (Karn's rule discards the samples
+ * that would otherwise raise it), up to the configured timeout. Only the
+ * command that timed out keeps doubling: a run of losses must not leave
+ * the commands after it waiting the full timeout.
+ */
+static long _Rto(IO_t io)
+{
+    long tmo = 1000L * io->timeout;
+    long rto = (io->rto > 0 ? io->rto : tmo);
+
+    for (int i = io->backoff; i > 0 && rto < tmo; i--)
+	rto *= 2;
+    return (rto < tmo ? rto : tmo);
+}
+
+/* Back the link's RTO off after a timeout, up to the configured one. */
+static void _Backoff(IO_t io)
+{
+    if (io->backoff < _RTO_BACKOFF && _Rto(io) < 1000L * io->timeout)
+	io->backoff++;
+}
+
+/* Load and send one message with the given sequence no. */
+static ssize_t _Post(IO_t io, MSG_t m, uint8_t seq)
+{
+    struct iovec *iov = &io->wiov;
+    ssize_t rc;
+
+    iov->iov_base = _BufPut(io, iov->iov_base);
+    io->seq = seq;
+    (void) _Load(io, m->tid, m->cmd, (const uint8_t *) m->pay,
+		(m->pay ? m->npay : 0), iov);
+    rc = io->Set(io);
+    iov->iov_base = _BufPut(io, iov->iov_base);
+    iov->iov_len = 0;
+    return rc;
+}
+
+/*==============================================================*/
+/*
+ * Command latency histograms, log-linear as in HdrHistogram: 4 linear
+ * sub-buckets per power of 2 nsecs (< 25% error), one set per (TID, CMD)
+ * and command phase. Recording is a few adds, so they are always on.
+ */
+enum LATPH_e {
+    LAT_ENCODE	= 0,	/* _Load */
+    LAT_SEND,		/* Set */
+    LAT_WAIT,		/* sent until the response was read */
+    LAT_RECV,		/* read until the frame was decoded and matched */
+    LAT_PARSE,		/* _Parse */
+    LAT_PROCESS,	/* _Process */
+    LAT_NPHASES
+};
+static const char * _lat_phases[LAT_NPHASES] = {
+    "encode", "send", "wait", "receive", "parse", "process"
+};
+
+#define	_LAT_SUB	2			/* log2(sub-buckets) */
+#define	_LAT_NBUCKETS	(32 << _LAT_SUB)	/* up to 2^33 nsecs */
+#define	_LAT_NKEYS	64
+
+typedef struct LAT_s * LAT_t;
+struct LAT_s {
+    uint8_t tid;
+    uint8_t cmd;
+    uint8_t used;
+    uint64_t n[LAT_NPHASES];
+    uint64_t sum[LAT_NPHASES];		/* nsecs */
+    uint64_t max[LAT_NPHASES];		/* nsecs */
+    uint32_t b[LAT_NPHASES][_LAT_NBUCKETS];
+};
+/* One table per process (~200KB: too big per link), shared by its links. */
+static struct LAT_s _lat[_LAT_NKEYS];	/* open addressed by (tid, cmd) */
+
+
+static unsigned _LatBucket(uint64_t ns)
+{
+    unsigned msb, ix;
+
+    if (ns < (1 << _LAT_SUB))
+	return ns;
+    msb = 63 - __builtin_clzll(ns);
+    ix = ((msb - _LAT_SUB + 1) << _LAT_SUB)
+	+ ((ns >> (msb - _LAT_SUB)) & ((1 << _LAT_SUB) - 1));
+    return (ix < _LAT_NBUCKETS ? ix : _LAT_NBUCKETS - 1);
+}
+
+/* Largest value (nsecs) that lands in bucket ix. */
+static uint64_t _LatValue(unsigned ix)
+{
+    unsigned msb, sub;
+
+    if (ix < (1 << _LAT_SUB))
+	return ix;
+    msb = (ix >> _LAT_SUB) + _LAT_SUB - 1;
+    sub = ix & ((1 << _LAT_SUB) - 1);
+    return ((uint64_t)((1 << _LAT_SUB) + sub + 1) << (msb - _LAT_SUB)) - 1;
+}
+
+static LAT_t _LatGet(unsigned tid, unsigned cmd)
+{
+    unsigned h = (tid * 31 + cmd) % _LAT_NKEYS;
+
+    for (unsigned i = 0; i < _LAT_NKEYS; i++) {
+	LAT_t lat = _lat + (h + i) % _LAT_NKEYS;
+	if (!lat->used) {
+	    lat->used = 1;
+	    lat->tid = tid;
+	    lat->cmd = cmd;
+	    return lat;
+	}
+	if (lat->tid == tid && lat->cmd == cmd)
+	    return lat;
+    }
+    return NULL;	/* table full: not recorded */
+}
+
+static void _LatAdd(LAT_t lat, int ph, int64_t ns)
+{
+    if (ns < 0)
+	ns = 0;
+    lat->n[ph]++;
+    lat->sum[ph] += ns;
+    if (lat->max[ph] < (uint64_t) ns)
+	lat->max[ph] = ns;
+    lat->b[ph][_LatBucket(ns)]++;
+}
+
+/* Value (nsecs) at or below which pct% of the phase's samples fall. */
+static uint64_t _LatPercentile(LAT_t lat, int ph, double pct)
+{
+    uint64_t want = (uint64_t) ceil(lat->n[ph] * pct / 100.0);
+    uint64_t seen = 0;
+
+    for (unsigned ix = 0; ix < _LAT_NBUCKETS; ix++) {
+	seen += lat->b[ph][ix];
+	if (seen >= want && seen > 0)
+	    return (_LatValue(ix) < lat->max[ph] ? _LatValue(ix) : lat->max[ph]);
+    }
+    return lat->max[ph];
+}
+
+/*==============================================================*/
+#if _IO_MAXWINDOW > 32
+#error "_IO_MAXWINDOW must fit in IO_s reqbusy"
+#endif
+
+/*
+ * Take a command slot from io->reqs[], falling back to the heap (and
+ * counting it with the buffer pool's) when all are queued.
+ */
+static REQ_t _ReqGet(IO_t io)
+{
+    REQ_t req;
+
+    if (~io->reqbusy) {
+	int i = __builtin_ctz(~io->reqbusy);
+	io->reqbusy |= (1U << i);
+	req = io->reqs + i;
+    } else {
+	io->pool.nheap++;
+	req = xmalloc(sizeof(*req));
+    }
+    memset(req, 0, offsetof(struct REQ_s, pay));
+    return req;
+}
+
+static void _ReqPut(IO_t io, REQ_t req)
+{
+    if (req >= io->reqs && req < io->reqs + _IO_MAXWINDOW)
+	io->reqbusy &= ~(1U << (req - io->reqs));
+    else
+	free(req);
+}
+
+static void _ReqPush(struct REQQ_s *q, REQ_t req)
+{
+    if (q->tail == NULL)
+	q->tail = &q->head;
+    req->next = NULL;
+    *q->tail = req;
+    q->tail = &req->next;
+    q->n++;
+}
+
+static REQ_t _ReqUnlink(struct REQQ_s *q, REQ_t req)
+{
+    REQ_t *reqp;
+
+    for (reqp = &q->head; *reqp; reqp = &(*reqp)->next) {
+	if (*reqp != req)
+	    continue;
+	*reqp = req->next;
+	if (q->tail == &req->next)
+	    q->tail = reqp;
+	req->next = NULL;
+	q->n--;
+	return req;
+    }
+    return NULL;
+}
+
+/* No. of commands that may be in flight (msgfmt 0 has no seq byte). */
+static size_t _Depth(IO_t io)
+{
+    if (io->window <= 0 || io->msgfmt == 0)
+	return 1;
+    return (io->window < _IO_MAXWINDOW ? io->window : _IO_MAXWINDOW);
+}
+
+static void _Transmit(IO_t io, REQ_t req)
+{
+    struct iovec *iov = &io->wiov;
+    uint64_t t0 = _Now();
+    uint64_t t1;
+
+    iov->iov_base = _BufPut(io, iov->iov_base);
+    io->seq = req->seq;
+    /* A resent command backs off on its own, from the RTO it was sent with. */
+    if (req->nretry == 0)
+	req->rto = _Rto(io);
+    else if (req->rto < 1000L * io->timeout)
+	req->rto = (2 * req->rto < 1000L * io->timeout
+		? 2 * req->rto : 1000L * io->timeout);
+    (void) _Load(io, req->tid, req->cmd, req->pay, req->npay, iov);
+    t1 = _Now();
+    (void) io->Set(io);
+    iov->iov_base = _BufPut(io, iov->iov_base);
+    iov->iov_len = 0;
+    req->wtv = io->wtv;		/* structure assignment */
+    req->wns = io->wns;
+    req->nsencode = t1 - t0;
+    req->nssend = _Now() - t1;
+
+    if (io->txdelay > 0) {
+	const struct timespec ts = { 0, 1000 * io->txdelay };
+	(void) nanosleep(&ts, NULL);
+    }
+}
+
+/* Send queued commands while the window has room. */
+static void _Pump(IO_t io)
+{
+    while (io->sendq.head && io->waitq.n < _Depth(io)) {
+	REQ_t req = _ReqUnlink(&io->sendq, io->sendq.head);
+	req->seq = io->nextseq++;
+	_ReqPush(&io->waitq, req);
+	_Transmit(io, req);
+    }
+}
+
+/* Retire a command, handing its result to the submitter. */
+static void _Finish(IO_t io, REQ_t req, int rc)
+{
+    DONE_t done = req->done;
+    void *arg = req->arg;
+
+    (void) _ReqUnlink(&io->waitq, req);
+    _Trace(io, TR_FINISH, rc, (rc ? 0 : io->retval), 0);
+    _ReqPut(io, req);
+    if (done)
+	(*done) (io, arg, rc, (rc ? 0 : io->retval));
+    _Pump(io);
+}
+
+static void _Resend(IO_t io, REQ_t req)
+{
+    req->nretry++;
+    if (exit_request
+     || (io->maxretrys > 0 && req->nretry >= io->maxretrys)) {
+	fprintf(stderr, "*** MAXRETRY(%d:%d) seq %u ***\n",
+			req->nretry, io->maxretrys, req->seq);
+	_Finish(io, req, -1);
+	return;
+    }
+    if (_io_debug)
+	fprintf(stderr, "*** RETRY(%d:%d) seq %u rto %ld ***\n",
+			req->nretry, io->maxretrys, req->seq, req->rto);
+    io->nresend++;
+    _Transmit(io, req);
+}
+
+/*
+ * Queue a command on io. It is sent as soon as the window has room, and
+ * done(io, arg, rc, retval) is called from _Dispatch (or _Complete) once
+ * it is answered, or with rc -1 after maxretrys. The payload (at most
+ * MSGBUFLEN bytes) is copied. Returns -1, and never calls done, if too long.
+ */
+static int _Submit(IO_t io, TID_t tid, CMD_t cmd,
+	const uint8_t *s, size_t ns, DONE_t done, void *arg)
+{
+    REQ_t req;
+
+    if (ns > MSGBUFLEN)
+	return -1;
+    req = _ReqGet(io);
+    req->tid = tid;
+    req->cmd = cmd;
+    req->done = done;
+    req->arg = arg;
+    req->npay = ns;
+    if (ns > 0)
+	(void) memcpy(req->pay, s, ns);
+    _ReqPush(&io->sendq, req);
+    _Pump(io);
+    return 0;
+}
+
+/* Match the frame in io->riov to the command in flight it answers. */
+static int _Complete(IO_t io)
+{
+    REQ_t req = io->waitq.head;
+    uint64_t t0 = _Now();
+    uint64_t t1;
+    uint64_t t2;
+    LAT_t lat;
+
+    if (_Parse(io, &io->riov)) {
+	fprintf(stderr, "*** IOERR ***\n");
+	return -1;
+    }
+    t1 = _Now();
+
+    /* A pushed sample answers no command: stamp it on arrival. */
+    if (io->tid == TID_A2D && _CMD_ISPUSH(io->cmd)) {
+	io->wtv = io->rtv;	/* structure assignment */
+	return (_Process(io) ? -1 : 0);
+    }
+
+    /*
+     * Match by sequence no. when the frame carries one, ignoring duplicates
+     * from retransmits. Without one, only the oldest command can be
+     * answered: a late response to an earlier command is dropped.
+     */
+    if (io->window > 0 && io->msgfmt != 0) {
+	for (; req; req = req->next) {
+	    if (req->seq == io->seq)
+		break;
+	}
+    }
+    if (req == NULL || req->tid != io->tid || req->cmd != (io->cmd & ~CMD_NAK))
+	return -1;	/* stale response */
+
+    /*
+     * Karn: a resent command gives an ambiguous sample, and so does a
+     * response the decoder held behind a stalled partial frame.
+     */
+    if (req->nretry == 0 && !io->dec.late)
+	_Rtt(io, (long)((int64_t)(io->rns - req->wns) / 1000));
+    io->wtv = req->wtv;		/* structure assignment */
+
+    /*
+     * The peer answers in order, so the commands sent before this one
+     * (unambiguously: not resent) that are still unanswered lost their
+     * response: resend them now rather than wait out their RTO.
+     */
+    if (io->window > 0 && io->msgfmt != 0 && req->nretry == 0) {
+	REQ_t r, next;
+	for (r = io->waitq.head; r && r != req; r = next) {
+	    next = r->next;
+	    if ((int64_t)(req->wns - r->wns) > 0)
+		_Resend(io, r);
+	}
+    }
+
+    /* Retry on NAK. */
+    if (io->cmd & CMD_NAK)
+	io->nnak++;
+    if ((io->cmd & CMD_NAK) || _Process(io)) {
+	_Resend(io, req);
+	return -1;
+    }
+    t2 = _Now();
+
+    if ((lat = _LatGet(req->tid, req->cmd)) != NULL) {
+	_LatAdd(lat, LAT_ENCODE, req->nsencode);
+	_LatAdd(lat, LAT_SEND, req->nssend);
+	_LatAdd(lat, LAT_WAIT, (int64_t)(io->rns - req->wns));
+	_LatAdd(lat, LAT_RECV, (int64_t)(t0 - io->rns));
+	_LatAdd(lat, LAT_PARSE, t1 - t0);
+	_LatAdd(lat, LAT_PROCESS, t2 - t1);
+    }
+    _Finish(io, req, 0);
+    return 0;
+}
+
+/* Resend the commands whose response is overdue at now (_Now() nsecs). */
+static size_t _Expire(IO_t io, uint64_t now)
+{
+    size_t nexpired = 0;
+    REQ_t req, next;
+
+    for (req = io->waitq.head; req; req = req->next) {
+	if ((int64_t)(now - req->wns) >= 1000LL * req->rto)
+	    break;
+    }
+    if (req == NULL)
+	return 0;
+
+    /*
+     * A partial frame (e.g. a corrupt count) may be holding back the
+     * responses behind it: look past it, and complete those first
+     * rather than resend every command in the window.
+     */
+    _DecStall(&io->dec);
+    while (io->waitq.head && _DecGet(&io->dec, io->msgfmt, &io->riov))
+	(void) _Complete(io);
+
+    for (req = io->waitq.head; req; req = next) {
+	next = req->next;
+	if ((int64_t)(now - req->wns) < 1000LL * req->rto)
+	    continue;
+	if (nexpired++ == 0) {
+	    if (_io_debug)
+fprintf(stderr, "    %s:\ttimeout rto %ld\n", flbl(io), req->rto);
+	    io->ntimeout++;
+	}
+	/* Back off once per flight: not again for commands sent before. */
+	if (req->nretry == 0 && req->rto >= _Rto(io))
+	    _Backoff(io);
+	_Resend(io, req);
+    }
+    return nexpired;
+}
+
+/* Fail every command still queued on io (e.g. on exit). */
+static void _Abort(IO_t io)
+{
+    while (io->sendq.head)
+	_ReqPush(&io->waitq, _ReqUnlink(&io->sendq, io->sendq.head));
+    while (io->waitq.head)
+	_Finish(io, io->waitq.head, -1);
+}
+
+/*
+ * Run one step of io's event loop: wait (one RTO at most) for a frame
+ * and complete the command it answers, resending overdue commands.
+ * Returns the no. of commands still outstanding, -1 on exit.
+ */
+static ssize_t _Dispatch(IO_t io)
+{
+    ssize_t rc;
+
+    if (io->waitq.head == NULL)
+	return io->sendq.n;
+
+    rc = io->Chk(io);
+    if (exit_request) {
+	_Abort(io);
+	return -1;
+    }
+    if (rc > 0)
+	(void) _Complete(io);
+    else
+	(void) _Expire(io, _Now());
+    return io->sendq.n + io->waitq.n;
+}
+
+/*==============================================================*/
+/* Completion of a blocking command. */
+typedef struct WAIT_s * WAIT_t;
+struct WAIT_s {
+    size_t *npending;	/* shared by a batch of commands, NULL once answered */
+    int rc;
+    uint16_t retval;
+};
+
+static void _Wake(IO_t io, void *arg, int rc, uint16_t retval)
+{
+    WAIT_t w = arg;
+
+    w->rc = rc;
+    w->retval = retval;
+    (*w->npending)--;
+    w->npending = NULL;		/* answered */
+}
+
 static int _Command(IO_t io, TID_t tid, CMD_t cmd,
 	const uint8_t *s, size_t ns, uint16_t *retvalp)
 {
-    static struct iovec ziov;	/* empty iovec */
-    struct iovec *iov;
-    uint16_t retval = 0;
+    size_t npending = 1;
+    struct WAIT_s w = { .npending = &npending, .rc = -1 };
     int rc = -1;	/* assume failure */
 
-    io->nretry = 0;
+    if (_Submit(io, tid, cmd, s, ns, _Wake, &w))
+	return rc;
+    while (npending > 0 && _Dispatch(io) >= 0)
+	;
+    rc = (npending == 0 ? w.rc : -1);
 
-resend:
-    /* Load message. */
-    iov = &io->wiov;
-    if (iov->iov_base)
-	free(iov->iov_base);
-    *iov = ziov;	/* structure assignment */
-    rc = _Load(io, tid, cmd, s, ns, iov);
+    /* Return a valid measurement. */
+    if (rc == 0 && retvalp)
+	*retvalp = w.retval;
+    return rc;
+}
 
-    /* Send message. */
-    rc = io->Set(io);
+/*
+ * Send msgs[] keeping up to io->window commands in flight. Responses are
+ * matched by sequence no., and each NAK (or timeout) retransmits only the
+ * affected command(s). At most _IO_MAXWINDOW commands are submitted at a
+ * time, so the waits (and command slots) come from fixed arrays.
+ */
+static int _Pipeline(IO_t io, MSG_t msgs, size_t nmsgs, uint16_t *retvals)
+{
+    struct WAIT_s w[_IO_MAXWINDOW];
+    size_t ix[_IO_MAXWINDOW];	/* msgs[] index of w[k], nmsgs if free */
+    size_t npending = 0;
+    size_t i = 0;
+    size_t ndone = 0;
+    int rc = -1;	/* assume failure */
 
-    /* Sleep 1msec (and context switch) to permit client to reply. */
-    {   const struct timespec ts = { 0, 1000000 };
-	(void) nanosleep(&ts, NULL);
+    for (size_t k = 0; k < _IO_MAXWINDOW; k++)
+	ix[k] = nmsgs;
+
+    do {
+	/* Collect the answered commands, then reuse their waits. */
+	for (size_t k = 0; k < _IO_MAXWINDOW; k++) {
+	    if (ix[k] < nmsgs && w[k].npending == NULL) {
+		if (w[k].rc == 0) {
+		    if (retvals)
+			retvals[ix[k]] = w[k].retval;
+		    ndone++;
+		}
+		ix[k] = nmsgs;
+	    }
+	    if (ix[k] == nmsgs && i < nmsgs && !exit_request) {
+		MSG_t m = msgs + i;
+		w[k].npending = &npending;
+		w[k].rc = -1;
+		if (_Submit(io, m->tid, m->cmd, (const uint8_t *) m->pay,
+			(m->pay ? m->npay : 0), _Wake, w + k) == 0) {
+		    ix[k] = i;
+		    npending++;
+		}
+		i++;
+	    }
+	}
+    } while (npending > 0 && _Dispatch(io) >= 0);
+
+    rc = (ndone == nmsgs ? 0 : -1);
+    if (_io_debug)
+fprintf(stderr, "<== %s: rc %d ndone %zu\n", flbl(io), rc, ndone);
+    return rc;
+}
+
+/*
+ * Send msgs[] as TID_BATCH frames, packing as many tuples (and their
+ * results) into each frame as fit, one round trip per frame.
+ */
+static int _BatchCommand(IO_t io, MSG_t msgs, size_t nmsgs, uint16_t *retvals)
+{
+    uint8_t s[MSGBUFLEN];
+    size_t i = 0;
+    int rc = 0;
+
+    if (io->msgfmt == 0)
+	return _Pipeline(io, msgs, nmsgs, retvals);
+
+    while (rc == 0 && i < nmsgs) {
+	uint8_t * se = s;
+	size_t n = 0;
+
+	while (i + n < nmsgs && n < _BATCH_NMAX) {
+	    MSG_t m = msgs + i + n;
+	    size_t npay = (m->pay ? m->npay : 0);
+	    if ((se - s) + 3 + npay > MSGBUFLEN - _FRAME_OVERHEAD)
+		break;
+	    *se++ = m->tid;
+	    *se++ = m->cmd;
+	    *se++ = npay;
+	    if (npay > 0) {
+		(void) memcpy(se, m->pay, npay);
+		se += npay;
+	    }
+	    n++;
+	}
+	if (n == 0) {
+	    rc = -1;
+	    break;
+	}
+
+	rc = _Command(io, TID_BATCH, n, s, (se - s), NULL);
+	for (size_t j = 0; rc == 0 && j < n; j++) {
+	    if (io->retb[4*j+1] & CMD_NAK)
+		rc = -1;
+	    else if (retvals)
+		retvals[i+j] = io->retb[4*j+2] << 8 | io->retb[4*j+3];
+	}
+	i += n;
+    }
+    return rc;
+}
+
+/* Read all the A2D sensors in one round trip. */
+static int _Sweep(IO_t io, uint16_t *retvals)
+{
+    struct MSG_s m[_NSENSORS];
+
+    for (int i = 0; i < _NSENSORS; i++) {
+	m[i].tid = TID_A2D;
+	m[i].cmd = i;
+	m[i].pay = NULL;
+	m[i].npay = 0;
+    }
+    return _BatchCommand(io, m, _NSENSORS, retvals);
+}
+
+/* Compare stop-and-wait against the pipelined window. */
+static int _CmdBench(IO_t io, size_t n)
+{
+    MSG_t m = xmalloc(n * sizeof(*m));
+    uint16_t *retvals = xmalloc(n * sizeof(*retvals));
+    struct timeval t0, t1;
+    double dw, sw, pw, bw;
+    int window = io->window;
+    size_t nresend = io->nresend;
+    int rc;
+
+    for (size_t i = 0; i < n; i++) {
+	m[i].tid = TID_PRES;		/* RDONLY, no sensor side effects */
+	m[i].cmd = i % _CMD_NDEVS;
+	m[i].pay = NULL;
+	m[i].npay = 0;
+    }
+
+    /* The fixed 1 msec sleep after each send that _Command used to do. */
+    io->txdelay = 1000;
+    (void) tstamp(&t0);
+    for (size_t i = 0; i < n && !exit_request; i++)
+	rc = _Command(io, m[i].tid, m[i].cmd, NULL, 0, retvals + i);
+    (void) tstamp(&t1);
+    dw = _Elapsed(&t0, &t1);
+    io->txdelay = 0;
+
+    (void) tstamp(&t0);
+    for (size_t i = 0; i < n && !exit_request; i++)
+	rc = _Command(io, m[i].tid, m[i].cmd, NULL, 0, retvals + i);
+    (void) tstamp(&t1);
+    sw = _Elapsed(&t0, &t1);
+
+    (void) tstamp(&t0);
+    rc = _Pipeline(io, m, n, retvals);
+    (void) tstamp(&t1);
+    pw = _Elapsed(&t0, &t1);
+
+    /* Batch one sweep of all the A2D sensors per round trip. */
+    (void) tstamp(&t0);
+    for (size_t i = 0; i + _NSENSORS <= n && !exit_request; i += _NSENSORS)
+	rc = _Sweep(io, retvals + i);
+    (void) tstamp(&t1);
+    bw = _Elapsed(&t0, &t1);
+
+fprintf(stderr, "*** %s: stop-and-wait latency %.1f usec/cmd (%.1f with 1 msec sleep)\n", __FUNCTION__, 1.0e6 * sw / n, 1.0e6 * dw / n);
+fprintf(stderr, "*** %s: %zu cmds: sleep 1 msec %.0f cmd/s, ready %.0f cmd/s\n", __FUNCTION__, n, n / dw, n / sw);
+fprintf(stderr, "*** %s: %zu cmds: stop-and-wait %.0f cmd/s, window %d %.0f cmd/s, batch %d %.0f cmd/s\n", __FUNCTION__, n, n / sw, window, n / pw, _NSENSORS, n / bw);
+
+    /*
+     * With timeouts to recover from, the window still must not lose.
+     * (Without any, both finish in msecs and the comparison is noise.)
+     */
+    if (window > 0 && io->nresend > nresend && pw > sw) {
+fprintf(stderr, "*** %s: window %d %.0f cmd/s is slower than stop-and-wait %.0f cmd/s\n", __FUNCTION__, window, n / pw, n / sw);
+	rc = -1;
+    }
+
+    free(retvals);
+    free(m);
+    return rc;
+}
+
+/*
+ * Time stop-and-wait commands at several line rates. Only the local end
+ * is reconfigured, so this needs a pty, which does not enforce the rate:
+ * the latency measured is the pty round trip at every rate, and the wire
+ * time the rate would add is computed, not measured.
+ */
+static int _BaudBench(IO_t io, size_t n)
+{
+    static const uint32_t bauds[] = { 9600, 19200, 57600, 115200 };
+    uint32_t baud = io->baud;
+    struct timeval t0, t1;
+    int rc = 0;
+
+fprintf(stderr, "*** %s: a pty ignores the line rate: usec/cmd is measured without it, wire time is computed only\n", __FUNCTION__);
+    for (size_t j = 0; j < sizeof(bauds)/sizeof(bauds[0]) && !exit_request; j++) {
+	struct iovec wiov = { NULL, 0 };
+	double dt, wire;
+	size_t nb;
+
+	if (_SerialConfig(io, io->fdno, bauds[j]))
+	    continue;
+	(void) tstamp(&t0);
+	for (size_t i = 0; i < n && !exit_request; i++)
+	    rc = _Command(io, TID_PRES, i % _CMD_NDEVS, NULL, 0, NULL);
+	(void) tstamp(&t1);
+	dt = _Elapsed(&t0, &t1);
+	/* 10 bit times (start + 8N1 + stop) per byte, both directions. */
+	(void) _Load(io, TID_PRES, 0, NULL, 0, &wiov);
+	nb = wiov.iov_len + io->riov.iov_len;	/* the last response frame */
+	wiov.iov_base = _BufPut(io, wiov.iov_base);
+	wire = 1.0e6 * 10 * nb / bauds[j];
+fprintf(stderr, "*** %s: %6u baud: %.1f usec/cmd measured, + %.1f usec computed wire time for %zu bytes\n", __FUNCTION__, bauds[j], 1.0e6 * dt / n, wire, nb);
+    }
+    (void) _SerialConfig(io, io->fdno, baud);
+    return rc;
+}
+
+/*
+ * Ask the device to push the A2D channels in mask every msecs (0 stops).
+ * The interval goes on the wire as 16 bits: longer ones are rejected.
+ */
+static int _Subscribe(IO_t io, uint32_t mask, unsigned msecs)
+{
+    uint8_t s[6];
+
+    if (msecs > 0xffff) {
+	fprintf(stderr, "*** %s: push interval %u msecs > 65535 ***\n", __FUNCTION__, msecs);
+	return -1;
+    }
+
+    s[0] = ((msecs >> 8) & 0xFF);
+    s[1] = ((msecs     ) & 0xFF);
+    s[2] = ((mask >> 24) & 0xFF);
+    s[3] = ((mask >> 16) & 0xFF);
+    s[4] = ((mask >>  8) & 0xFF);
+    s[5] = ((mask      ) & 0xFF);
+    return _Command(io, TID_A2D, (msecs > 0 ? CMD_ON : CMD_OFF),
+		s, (msecs > 0 ? sizeof(s) : 0), NULL);
+}
+
+/*
+ * Take up to n pushed samples into the sensor pipeline, returning the no.
+ * taken. Gives up after maxretrys waits without a frame.
+ */
+static size_t _Stream(IO_t io, size_t n)
+{
+    size_t n0 = io->npush;
+    int nidle = 0;
+
+    while (io->npush - n0 < n && !exit_request) {
+	ssize_t rc = io->Chk(io);
+	if (rc > 0) {
+	    (void) _Complete(io);
+	    nidle = 0;
+	} else if (rc < 0 || ++nidle > io->maxretrys)
+	    break;
     }
+    return io->npush - n0;
+}
 
-    /* Read response. */
-    iov = &io->riov;
-    if (iov->iov_base)
-	free(iov->iov_base);
-    *iov = ziov;	/* structure assignment */
-    rc = io->Chk(io);
-
-    /* Process the response. */
-    iov = &io->riov;
-    rc = _Parse(io, iov);
-    if (rc) {
-	fprintf(stderr, "*** IOERR ***\n");
-    } else
-	rc = _Process(io);
+/*
+ * Subscribe to all the A2D sensors, take n rounds of pushed samples, and
+ * report the rate and the sampling clock as seen at the NUC.
+ */
+static int _PushBench(IO_t io, unsigned msecs, size_t n)
+{
+    struct SENSOR_s *sensor = &io->urg->sensor;	/* channel 0 */
+    uint32_t mask = (1U << _NSENSORS) - 1;
+    struct timeval t0, t1, last;
+    struct STAT_s ival;		/* msecs between channel 0 samples */
+    size_t nsamples = 0;
+    double w;
+    int rc = -1;	/* assume failure */
 
-    /* Retry on NAK (or IO error). */
-    if (rc) {
-	io->nretry++;
-	if (io->maxretrys <= 0 || io->nretry < io->maxretrys) {
-	    fprintf(stderr, "*** RETRY(%d:%d) ***\n",
-			io->nretry, io->maxretrys);
-	    goto resend;
-	}
-	fprintf(stderr, "*** MAXRETRY(%d:%d) ***\n",
-			io->nretry, io->maxretrys);
+    memset(&ival, 0, sizeof(ival));
+    if (_Subscribe(io, mask, msecs))
 	goto exit;
+    (void) tstamp(&t0);
+    last = sensor->tstamp;	/* structure assignment */
+    while (nsamples < n * _NSENSORS && !exit_request) {
+	if (_Stream(io, 1) == 0)
+	    break;
+	nsamples++;
+	if (!timercmp(&sensor->tstamp, &last, !=))
+	    continue;
+	if (timercmp(&last, &t0, >))	/* an interval between pushes */
+	    _StatAdd(&ival, _F2I(1.0e3 * _Elapsed(&last, &sensor->tstamp)));
+	last = sensor->tstamp;	/* structure assignment */
     }
-    io->nretry = 0;
-
-    /* Return a valid measurement. */
-    retval = io->retval;
-    if (retvalp)
-	*retvalp = retval;
-
-    rc = 0;
+    (void) tstamp(&t1);
+    w = _Elapsed(&t0, &t1);
+    rc = _Subscribe(io, mask, 0);
+
+fprintf(stderr, "*** %s: %zu samples of %d channels every %u msecs in %.3f secs: %.0f samples/s, 1 frame/sample (2 polled)\n", __FUNCTION__, nsamples, _NSENSORS, msecs, w, nsamples / w);
+    if (ival.n > 0)
+fprintf(stderr, "*** %s: channel 0 interval %.3f+-%.3f msecs (min %.3f max %.3f)\n", __FUNCTION__, _I2F(_StatMean(&ival)), _I2F(_StatStddev(&ival)), _I2F(ival.min), _I2F(ival.max));
+    if (nsamples < n * _NSENSORS)
+	rc = -1;
 
 exit:
-fprintf(stderr, "<== %s: rc %d retval %u\n", flbl(io), rc, retval);
     return rc;
 }
 
-static FLOAT_t _SAvg(IO_t io, CMD_t cmd, uint16_t val)
+/*
+ * Set the measurement point of each of sensors cmds[0..n-1], then read
+ * them all navg times, in as few round trips as the batch frames allow:
+ * the D2A set-points go first, the A2D reads follow interleaved.
+ */
+static int _SAvgAll(IO_t io, const CMD_t *cmds, const uint16_t *vals,
+		int n, FLOAT_t *svals)
 {
-    int ix = cmd;
-    struct SENSOR_s *sensors = &urg->sensor;
-    struct SENSOR_s *sensor = sensors + ix;
-    FLOAT_t sval;
-    uint16_t retval;
-    uint8_t s[2];
-    size_t ns = sizeof(s);
+    struct SENSOR_s *sensors = &io->urg->sensor;
     int navg = 5;
+    struct MSG_s m[n * (1 + navg)];
+    uint16_t retvals[n * (1 + navg)];
+    uint8_t s[n][2];
+    int nm = 0;
     int rc = -1;	/* assume failure */
 
-    /* XXX Set the measurement point. */
-    s[0] = ((val >> 8) & 0xFF);
-    s[1] = ((val     ) & 0xFF);
-    rc = _Command(io, TID_D2A, cmd, s, ns, &retval);
+    /* XXX Set the measurement points, then read the measurements. */
+    for (int k = 0; k < n; k++) {
+	s[k][0] = ((vals[k] >> 8) & 0xFF);
+	s[k][1] = ((vals[k]     ) & 0xFF);
+	m[nm].tid = TID_D2A;
+	m[nm].cmd = cmds[k];
+	m[nm].pay = (const char *) s[k];
+	m[nm].npay = sizeof(s[k]);
+	nm++;
+    }
+    for (int i = 0; i < navg; i++) {
+	for (int k = 0; k < n; k++) {
+	    m[nm].tid = TID_A2D;
+	    m[nm].cmd = cmds[k];
+	    m[nm].pay = NULL;
+	    m[nm].npay = 0;
+	    nm++;
+	}
+    }
+    rc = _BatchCommand(io, m, nm, retvals);
 
-    /* Read the measurement. */
-    for (int i = 0; i < navg; i++)
-	rc = _Command(io, TID_A2D, cmd, NULL, 0, &retval);
-    sval = sensor->avg;
-    rc = 0;
-    return sval;
+    _BankFlush(io->urg);
+    for (int k = 0; k < n; k++) {
+	struct SENSOR_s *sensor = sensors + cmds[k];
+	_SensorSync(sensor);
+	svals[k] = sensor->avg;
+    }
+    return rc;
 }
 
-static int _SCal(IO_t io, CMD_t cmd, RANGE_t *range)
+/*
+ * Calibrate sensors cmds[0..n-1] together, a phase (offset, gain, then
+ * each reference point) at a time, so that every phase costs one
+ * _SAvgAll() round trip however many sensors are calibrated. If a phase
+ * fails, the sensors keep the calibration they had before.
+ */
+static int _SCalAll(IO_t io, const CMD_t *cmds, RANGE_t **ranges, int n)
 {
-    int ix = cmd;
-    struct SENSOR_s *sensors = &urg->sensor;
-    struct SENSOR_s *sensor = sensors + ix;
-    FLOAT_t loval;
-    FLOAT_t sval;
-    FLOAT_t hival;
-    uint16_t val;
+    struct SENSOR_s *sensors = &io->urg->sensor;
+    FLOAT_t loval[n];
+    FLOAT_t hival[n];
+    FLOAT_t refs[n][1 + 5];
+    FLOAT_t syss[n][1 + 5];
+    int nref[n];
+    CMD_t pcmds[n];
+    uint16_t pvals[n];
+    FLOAT_t psvals[n];
+    int pix[n];
+    struct SENSOR_s saved[n];
+    uint32_t lutmask = io->urg->bank.lutmask;
+    int maxref = 0;
     int rc = -1;	/* assume failure */
 
-    sensor->gain = (range->max - range->min) / sensor->rmax;
-    sensor->off = range->min;
-    sensor->min = range->max;
-    sensor->max = range->min;;
+    for (int k = 0; k < n; k++) {
+	int ix = cmds[k];
+	struct SENSOR_s *sensor = sensors + ix;
+	RANGE_t *range = ranges[k];
+
+	saved[k] = *sensor;	/* structure assignment */
+
+	sensor->gain = (range->max - range->min) / sensor->rmax;
+	sensor->off = range->min;
+
+	/* Measure through the linear scaling until the table is rebuilt. */
+	io->urg->bank.lutmask &= ~(1U << ix);
+
+	/* Reference points: range->val, then range->ref[]. */
+	nref[k] = 0;
+	refs[k][nref[k]++] = range->val;
+	for (int j = 0; j < range->npts && j < 5; j++)
+	    refs[k][nref[k]++] = range->ref[j];
+	if (maxref < nref[k])
+	    maxref = nref[k];
+    }
 
     /* Calibrate offset. */
-    sensor->npts = 0;
-    sensor->sum = 0;
-    val = 0x0000;
-    loval = _SAvg(io, cmd, val);
-sensor->off = loval;
+    for (int k = 0; k < n; k++) {
+	_SensorReset(io->urg, cmds[k]);
+	pvals[k] = 0x0000;
+    }
+    if (_SAvgAll(io, cmds, pvals, n, loval))
+	goto exit;
+    for (int k = 0; k < n; k++)
+sensors[cmds[k]].off = loval[k];
 
     /* Calibrate gain. */
-    sensor->npts = 0;
-    sensor->sum = 0;
-    val = sensor->rmax;
-    hival = _SAvg(io, cmd, val);
-sensor->gain = (hival - loval)/sensor->rmax;
-
-    /* Calibrate reference point. */
-    sensor->npts = 0;
-    sensor->sum = 0;
-    val = (range->val - range->min) / sensor->gain;
-    sval = _SAvg(io, cmd, val);
-
-    /* Save reference point. */
-    sensor->sys = sval;
-    sensor->ref = range->val;
-
-    /* Reset the measurement. */
-    sensor->npts = 0;
-    sensor->sum = 0;
-    rc = 0;
+    for (int k = 0; k < n; k++) {
+	_SensorReset(io->urg, cmds[k]);
+	pvals[k] = sensors[cmds[k]].rmax;
+    }
+    if (_SAvgAll(io, cmds, pvals, n, hival))
+	goto exit;
+    for (int k = 0; k < n; k++) {
+	struct SENSOR_s *sensor = sensors + cmds[k];
+sensor->gain = (hival[k] - loval[k])/sensor->rmax;
+    }
+
+    /* Calibrate reference points, each with the sensors that have it. */
+    for (int j = 0; j < maxref; j++) {
+	int np = 0;
+	for (int k = 0; k < n; k++) {
+	    struct SENSOR_s *sensor = sensors + cmds[k];
+	    if (j >= nref[k])
+		continue;
+	    _SensorReset(io->urg, cmds[k]);
+	    pix[np] = k;
+	    pcmds[np] = cmds[k];
+	    pvals[np] = (refs[k][j] - ranges[k]->min) / sensor->gain;
+	    np++;
+	}
+	if (_SAvgAll(io, pcmds, pvals, np, psvals))
+	    goto exit;
+	for (int p = 0; p < np; p++)
+	    syss[pix[p]][j] = psvals[p];
+    }
+
+    for (int k = 0; k < n; k++) {
+	int ix = cmds[k];
+	struct SENSOR_s *sensor = sensors + ix;
+	FLOAT_t sval = syss[k][0];
+
+	/* Save reference point. */
+	sensor->sys = sval;
+	sensor->ref = ranges[k]->val;
+
+	/* Reset the measurement, then convert through the corrected table. */
+	_SensorReset(io->urg, ix);
+	_SensorLUT(io->urg, ix, syss[k], refs[k], nref[k]);
+	if (_io_debug) {
+fprintf(stderr, "\t%s[%d]\n", __FUNCTION__, ix);
 fprintf(stderr, "\t  gain %9.4f\n", _I2F(sensor->gain));
 fprintf(stderr, "\t   off %7.2f\n", _I2F(sensor->off));
-fprintf(stderr, "\t loval %7.2f\n", _I2F(loval));
+fprintf(stderr, "\t loval %7.2f\n", _I2F(loval[k]));
 fprintf(stderr, "\t  sval %7.2f\n", _I2F(sval));
-fprintf(stderr, "\t hival %7.2f\n", _I2F(hival));
+fprintf(stderr, "\t hival %7.2f\n", _I2F(hival[k]));
 fprintf(stderr, "\t   sys %7.2f\n", _I2F(sensor->sys));
 fprintf(stderr, "\t   ref %7.2f\n", _I2F(sensor->ref));
+	    for (int j = 1; j < nref[k]; j++)
+fprintf(stderr, "\t   ref %7.2f sys %7.2f\n", _I2F(refs[k][j]), _I2F(syss[k][j]));
+	}
+    }
+    rc = 0;
+
+exit:
+    if (rc) {
+	for (int k = 0; k < n; k++) {
+	    struct SENSOR_s *sensor = sensors + cmds[k];
+	    sensor->gain = saved[k].gain;
+	    sensor->off = saved[k].off;
+	    sensor->sys = saved[k].sys;
+	    sensor->ref = saved[k].ref;
+	    _SensorReset(io->urg, cmds[k]);
+	}
+	io->urg->bank.lutmask = lutmask;
+    }
 fprintf(stderr, "<== %s: rc %d\n", flbl(io), rc);
     return rc;
 }
 
 /*==============================================================*/
+/*==============================================================*/
+/* One latency histogram summarized for JSON (times in usecs). */
+struct LATROW_s {
+    char key[8];	/* "TID/CMD" */
+    char phase[8];
+    uint64_t n;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+};
+
+/*
+ * Print the protocol counters summed over ios[] and the latency
+ * histograms as one JSON object, then start the histograms afresh.
+ * There is one histogram table per process, not per link: it covers
+ * every link the process drives, so pass all of them in ios[].
+ */
+static int _StatsJSON(IO_t *ios, size_t nios, FILE *fp)
+{
+    struct LATROW_s *rows = xcalloc(_LAT_NKEYS * LAT_NPHASES, sizeof(*rows));
+    uint64_t ncrc = 0, nframing = 0, nresync = 0, ndropped = 0, nnak = 0;
+    uint64_t ntimeout = 0, nretry = 0;
+    unsigned nlinks = nios;
+    int nrows = 0;
+    char *b = NULL;
+    size_t nb;
+    int rc;
+
+    for (size_t i = 0; i < nios; i++) {
+	IO_t io = ios[i];
+	ncrc += io->dec.ncrc;
+	nframing += io->dec.nframing;
+	nresync += io->dec.nresync;
+	ndropped += io->dec.ndropped;
+	nnak += io->nnak;
+	ntimeout += io->ntimeout;
+	nretry += io->nresend;
+    }
+
+    for (int i = 0; i < _LAT_NKEYS; i++) {
+	LAT_t lat = _lat + i;
+	if (!lat->used)
+	    continue;
+	for (int ph = 0; ph < LAT_NPHASES; ph++) {
+	    struct LATROW_s *row = rows + nrows++;
+	    (void) snprintf(row->key, sizeof(row->key), "%c/%u",
+			isprint(lat->tid) ? lat->tid : '?', lat->cmd);
+	    (void) snprintf(row->phase, sizeof(row->phase), "%s",
+			_lat_phases[ph]);
+	    row->n = lat->n[ph];
+	    row->mean = (lat->n[ph] ? lat->sum[ph] / 1.0e3 / lat->n[ph] : 0);
+	    row->p50 = _LatPercentile(lat, ph, 50.0) / 1.0e3;
+	    row->p90 = _LatPercentile(lat, ph, 90.0) / 1.0e3;
+	    row->p99 = _LatPercentile(lat, ph, 99.0) / 1.0e3;
+	    row->p999 = _LatPercentile(lat, ph, 99.9) / 1.0e3;
+	    row->max = lat->max[ph] / 1.0e3;
+	}
+    }
+
+    {	/*@-type@*/
+	const struct json_attr_t json_attrs_latency[] = {
+	    {"key",	t_string,  .addr.offset = offsetof(struct LATROW_s, key),
+				   .len = sizeof(rows->key)},
+	    {"phase",	t_string,  .addr.offset = offsetof(struct LATROW_s, phase),
+				   .len = sizeof(rows->phase)},
+	    {"n",	t_uinteger, .addr.offset = offsetof(struct LATROW_s, n),
+				   .len = sizeof(rows->n)},
+	    {"mean",	t_real,    .addr.offset = offsetof(struct LATROW_s, mean)},
+	    {"p50",	t_real,    .addr.offset = offsetof(struct LATROW_s, p50)},
+	    {"p90",	t_real,    .addr.offset = offsetof(struct LATROW_s, p90)},
+	    {"p99",	t_real,    .addr.offset = offsetof(struct LATROW_s, p99)},
+	    {"p999",	t_real,    .addr.offset = offsetof(struct LATROW_s, p999)},
+	    {"max",	t_real,    .addr.offset = offsetof(struct LATROW_s, max)},
+	    {NULL},
+	};
+	const struct json_attr_t json_attrs_stats[] = {
+	    {"links",	t_uinteger, .addr.uinteger = &nlinks},
+	    {"crc",	t_uinteger, .addr.uinteger = (unsigned *) &ncrc,
+				   .len = sizeof(ncrc)},
+	    {"framing",	t_uinteger, .addr.uinteger = (unsigned *) &nframing,
+				   .len = sizeof(nframing)},
+	    {"resync",	t_uinteger, .addr.uinteger = (unsigned *) &nresync,
+				   .len = sizeof(nresync)},
+	    {"dropped",	t_uinteger, .addr.uinteger = (unsigned *) &ndropped,
+				   .len = sizeof(ndropped)},
+	    {"nak",	t_uinteger, .addr.uinteger = (unsigned *) &nnak,
+				   .len = sizeof(nnak)},
+	    {"timeouts", t_uinteger, .addr.uinteger = (unsigned *) &ntimeout,
+				   .len = sizeof(ntimeout)},
+	    {"retries",	t_uinteger, .addr.uinteger = (unsigned *) &nretry,
+				   .len = sizeof(nretry)},
+	    {"latency",	t_array,   .addr.array.element_type = t_structobject,
+				   .addr.array.arr.objects.base = (char *) rows,
+				   .addr.array.arr.objects.stride = sizeof(*rows),
+				   .addr.array.arr.objects.subtype = json_attrs_latency,
+				   .addr.array.count = &nrows,
+				   .addr.array.maxlen = nrows},
+	    {NULL},
+	};
+	/*@+type@*/
+
+	nb = 1024 + nrows * 256;
+	b = xmalloc(nb);
+	b[0] = '\0';
+	rc = json_spew_object(b, nb, json_attrs_stats, NULL);
+    }
+    if (rc == 0) {
+	fprintf(fp, "%s\n", b);
+	(void) fflush(fp);	/* before any fork duplicates the buffer */
+    } else
+	fprintf(stderr, "*** %s: %s\n", __FUNCTION__, json_error_string(rc));
+
+    memset(_lat, 0, sizeof(_lat));
+    free(b);
+    free(rows);
+    return rc;
+}
+
 static int _Parent(IO_t io)
 {
     static struct iovec ziov;	/* empty iovec */
@@ -1616,28 +5130,59 @@ static int _Parent(IO_t io)
 
 fprintf(stderr, "==> %s\n", flbl(io));
 
-    /* Calibrate the temperature sensors. */
-    rc = _SCal(io, CMD_ambient,	&_temperature_celsius);
-fprintf(stderr, "====================\n");
+    /* Calibrate the temperature and pressure sensors together. */
+    {	static const CMD_t cmds[] = {
+	    CMD_ambient,
 #ifdef	NOTYET
-    rc = _SCal(io, CMD_filter,	&_temperature_celsius);
-fprintf(stderr, "====================\n");
-    rc = _SCal(io, CMD_meter,	&_temperature_celsius);
-fprintf(stderr, "====================\n");
-    rc = _SCal(io, CMD_inactive,	&_temperature_celsius);
-fprintf(stderr, "====================\n");
+	    CMD_filter,
+	    CMD_meter,
+	    CMD_inactive,
 #endif
-
-    /* Calibrate the pressure sensors. */
-    rc = _SCal(io, CMD_barometer, &_barometer_torr);
+	    CMD_barometer,
+#ifdef	NOTYET
+	    CMD_meter_drop,
+	    CMD_flow_sensor,
+#endif
+	};
+	RANGE_t *ranges[] = {
+	    &_temperature_celsius,
+#ifdef	NOTYET
+	    &_temperature_celsius,
+	    &_temperature_celsius,
+	    &_temperature_celsius,
+#endif
+	    &_barometer_torr,
+#ifdef	NOTYET
+	    W2DO,
+	    W2DO,
+#endif
+	};
+	int ncal = sizeof(cmds) / sizeof(cmds[0]);
+	size_t nrtt = io->nrtt;
+	struct timeval t0, t1;
+
+	(void) tstamp(&t0);
+	rc = _SCalAll(io, cmds, ranges, ncal);
+	(void) tstamp(&t1);
+	if (_io_debug)
+fprintf(stderr, "*** %s: %d sensors in %.3f msecs, %zu round trips\n", __FUNCTION__, ncal, 1.0e3 * _Elapsed(&t0, &t1), io->nrtt - nrtt);
+    }
 fprintf(stderr, "====================\n");
 
-#ifdef	NOTYET
-    rc = _SCal(io, CMD_meter_drop, W2DO);
+    if (_cmd_bench > 0) {
+	rc = _CmdBench(io, _cmd_bench);
 fprintf(stderr, "====================\n");
-    rc = _SCal(io, CMD_flow_sensor, W2DO);
+	if (io->baud && io->sv[1] >= 0) {
+	    rc = _BaudBench(io, _cmd_bench);
 fprintf(stderr, "====================\n");
-#endif
+	}
+    }
+
+    if (_push_msecs > 0) {
+	rc = _PushBench(io, _push_msecs,
+		(_cmd_bench > 0 ? _cmd_bench / _NSENSORS : 100));
+fprintf(stderr, "====================\n");
+    }
 
     /* Send all the canned messages. */
     for (size_t i = 0; i < nmsgs; i++) {
@@ -1656,13 +5201,28 @@ fprintf(stderr, "====================\n");
     }
 
     iov = &io->riov;
-    if (iov->iov_base)
-	free(iov->iov_base);
+    iov->iov_base = _BufPut(io, iov->iov_base);
     *iov = ziov;	/* structure assignment */
     iov = &io->wiov;
-    if (iov->iov_base)
-	free(iov->iov_base);
+    iov->iov_base = _BufPut(io, iov->iov_base);
     *iov = ziov;	/* structure assignment */
+    if (_io_debug)
+fprintf(stderr, "    %s:\tbuffers %zu heap %zu\n", flbl(io), io->pool.nget, io->pool.nheap);
+    if (_io_debug)
+fprintf(stderr, "    %s:\trtt %ld+-%ld rto %ld usecs, %zu samples, %d timeouts, %zu resent\n", flbl(io), io->srtt, io->rttvar, _Wait(io), io->nrtt, io->ntimeout, io->nresend);
+    if (_io_stats)
+	(void) _StatsJSON(&io, 1, stdout);
+#if defined(linux) && defined(__NR_io_uring_setup)
+    if (io->ring) {
+	if (_io_debug)
+fprintf(stderr, "    %s:\turing enters %zu\n", flbl(io), io->ring->nenter);
+	io->ring = _UringFree(io->ring);
+    }
+#endif
+#if defined(linux) && defined(__NR_memfd_create) && defined(__NR_futex)
+    if (_io_debug && io->shm)
+fprintf(stderr, "    %s:\tshm waits %zu wakes %zu\n", flbl(io), _ShmRx(io)->nwait, _ShmTx(io)->nwake);
+#endif
 fprintf(stderr, "<== %s: rc %d\n", flbl(io), rc);
     return rc;
 }
@@ -1679,6 +5239,7 @@ static int _Fork(IO_t pio)
 	goto exit;
     case 0:
     {	IO_t io = memcpy(xmalloc(sizeof(*pio)), pio, sizeof(*pio));
+	_TraceOpen();
 	io->role = "avr";	/* XXX */
 	io->fdno = pio->sv[1];	/* XXX */
 	rc = _Child(io);
@@ -1701,9 +5262,8 @@ exit:
 }
 
 /*==============================================================*/
-static IO_t newIO(int (*Open) (IO_t io))
+static IO_t newIO(int (*Open) (IO_t io), URG_t urg)
 {
-    static const char _fmt[] = " %Y-%m-%d %H:%M:%S";
     IO_t io = calloc(1, sizeof(*io));
 
     if (Open) {
@@ -1711,42 +5271,512 @@ static IO_t newIO(int (*Open) (IO_t io))
 
 	/* XXX Bootstrap debugging. */
 	io->role = "new";
-	io->fmt = _fmt;
+	io->fmt = _io_fmt;
 
 	/* XXX Ensure EBADF */
 	io->fdno = -1;
 	io->sv[0] = -1;
 	io->sv[1] = -1;
+	io->urg = urg;
 
 	/* Create the channel */
 	rc = (*Open) (io);
 	if (rc != -1) {
 	    io->msgfmt = 1;		/* 0=hex, 1=binary, 2=HDLC-like */
-	    io->maxtimeouts = 4;
-	    io->maxretrys = 4;
+	    io->timeout = (_io_timeout > 0 ? _io_timeout : 1000);
+	    /* Each wait is one RTO, _Dispatch backs off and resends. */
+	    io->maxtimeouts = 1;
+	    io->maxretrys = 8;
+	    io->window = _io_window;
+	    io->delay = _emu_delay;
+	    io->jitter = _emu_jitter;
+	    io->pdrop = _emu_drop;
+	    io->pcorrupt = _emu_corrupt;
+	    io->seed = (unsigned) getpid() ^ (unsigned)(uintptr_t) io;
 	    memset(io->ADvals, 0xff, sizeof(io->ADvals));
 	    io->Close = _Close;
+#if defined(linux)
+	    io->Chk = (_io_epoll ? _Epoll : _Poll);
+#else
 	    io->Chk = _Poll;
+#endif
 	    io->Get = _Readv;
 	    io->Set = _Writev;
+#if defined(linux) && defined(__NR_io_uring_setup)
+	    if (_io_uring) {
+		io->Chk = _UringPoll;
+		io->Get = _UringReadv;
+		io->Set = _UringWritev;
+	    }
+#endif
+#if defined(linux) && defined(__NR_memfd_create) && defined(__NR_futex)
+	    if (io->shm) {
+		io->Close = _ShmClose;
+		io->Chk = _ShmPoll;
+		io->Get = _ShmReadv;
+		io->Set = _ShmWritev;
+	    }
+#endif
 	}
     }
 
     return io;
 }
 
+/*==============================================================*/
+/*
+ * Feed the bytes received in a capture back through each link's decoder,
+ * _Parse and _Process, flat out or (with --pace) at the recorded times.
+ * Sent bytes are skipped: the peer's receive records hold the same bytes.
+ * Only the NUC's links are replayed: the AVR received commands, which the
+ * NUC's _Process would take for responses.
+ */
+static int _Replay(const char *fn)
+{
+    static const char * roles[] = { "nuc", "avr", "new" };
+    FILE *fp = fopen(fn, "r");
+    struct CAPHDR_s hdr;
+    struct CAPREC_s r;
+    uint8_t b[UINT16_MAX];
+    IO_t *ios = NULL;
+    uint32_t *pids = NULL;
+    size_t nios = 0;
+    size_t nrecs = 0, nbytes = 0, nframes = 0, nparse = 0, nprocess = 0;
+    size_t nskipped = 0;
+    uint64_t r0 = 0, r1 = 0;
+    struct timespec ts0;
+    struct timeval t0, t1;
+    double w;
+    int rc = -1;	/* assume failure */
+
+    if (fp == NULL) {
+	perror(fn);
+	goto exit;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+     || strcmp(hdr.magic, "TURGCAP") || hdr.reclen != sizeof(r)) {
+	fprintf(stderr, "%s: not a turg capture\n", fn);
+	goto exit;
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts0);
+    (void) tstamp(&t0);
+    while (!exit_request && fread(&r, sizeof(r), 1, fp) == 1) {
+	IO_t io = NULL;
+	size_t off;
+
+	if (fread(b, 1, r.len, fp) != r.len) {
+	    fprintf(stderr, "%s: truncated record %zu\n", fn, nrecs);
+	    goto exit;
+	}
+	if (nrecs++ == 0)
+	    r0 = r.nsecs;
+	r1 = r.nsecs;
+	if (r.dir != '<')
+	    continue;
+	if (strcmp(roles[r.role < 3 ? r.role : 2], "nuc")) {
+	    nskipped++;
+	    continue;
+	}
+	nbytes += r.len;
+
+	/* A link is the (pid, fdno) pair that received the bytes. */
+	for (size_t i = 0; i < nios; i++) {
+	    if (pids[i] == r.pid && ios[i]->fdno == r.fdno) {
+		io = ios[i];
+		break;
+	    }
+	}
+	if (io == NULL) {
+	    io = newIO(NULL, &_urg);
+	    io->role = roles[r.role < 3 ? r.role : 2];
+	    io->fmt = _io_fmt;
+	    io->fdno = r.fdno;
+	    io->urg = &_urg;
+	    io->msgfmt = r.msgfmt;
+	    io->window = r.window;
+	    memset(io->ADvals, 0xff, sizeof(io->ADvals));
+	    ios = xrealloc(ios, (nios + 1) * sizeof(*ios));
+	    pids = xrealloc(pids, (nios + 1) * sizeof(*pids));
+	    pids[nios] = r.pid;
+	    ios[nios++] = io;
+	}
+
+	if (_replay_pace) {
+	    uint64_t ns = (uint64_t) ts0.tv_sec * 1000000000 + ts0.tv_nsec
+			+ (r.nsecs - r0);
+	    struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+	    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR
+		&& !exit_request)
+		;
+	}
+	(void) tstamp(&io->rtv);
+	io->wtv = io->rtv;	/* structure assignment */
+
+	/* Refill the decoder as the reads did, then handle each frame. */
+	for (off = 0; off < r.len; ) {
+	    struct iovec *iov = &io->riov;
+	    size_t nb = _DecSpace(&io->dec, iov);
+	    if (nb > r.len - off)
+		nb = r.len - off;
+	    (void) memcpy(iov->iov_base, b + off, nb);
+	    (void) _DecAdd(&io->dec, iov, nb);
+	    off += nb;
+
+	    while (_DecGet(&io->dec, io->msgfmt, iov)) {
+		uint64_t ns0 = _Now();
+		uint64_t ns1;
+		LAT_t lat;
+
+		nframes++;
+		if (_Parse(io, iov)) {
+		    nparse++;
+		    continue;
+		}
+		ns1 = _Now();
+		if (io->cmd & CMD_NAK) {
+		    io->nnak++;
+		    continue;
+		}
+		if (_Process(io))
+		    nprocess++;
+		if ((lat = _LatGet(io->tid, io->cmd)) != NULL) {
+		    _LatAdd(lat, LAT_PARSE, ns1 - ns0);
+		    _LatAdd(lat, LAT_PROCESS, _Now() - ns1);
+		}
+	    }
+	}
+    }
+    (void) tstamp(&t1);
+    w = _Elapsed(&t0, &t1);
+
+    for (size_t i = 0; i < nios; i++) {
+	IO_t io = ios[i];
+fprintf(stderr, "    %s:\tpid %u crc %zu framing %zu dropped %zu nak %zu\n", flbl(io), pids[i], io->dec.ncrc, io->dec.nframing, io->dec.ndropped, io->nnak);
+    }
+fprintf(stderr, "*** %s: %zu records, %zu bytes received on %zu links (%zu AVR records skipped)\n", __FUNCTION__, nrecs, nbytes, nios, nskipped);
+fprintf(stderr, "*** %s: %zu frames, %zu parse errors, %zu process errors\n", __FUNCTION__, nframes, nparse, nprocess);
+fprintf(stderr, "*** %s: %.3f secs (recorded %.3f secs), %.0f frames/s\n", __FUNCTION__, w, (r1 - r0) / 1.0e9, (w > 0 ? nframes / w : 0));
+    if (_io_stats)
+	(void) _StatsJSON(ios, nios, stdout);
+    rc = 0;
+
+exit:
+    for (size_t i = 0; i < nios; i++)
+	free(ios[i]);
+    free(ios);
+    free(pids);
+    if (fp)
+	(void) fclose(fp);
+    return rc;
+}
+
+#if defined(linux)
+/*==============================================================*/
+/* Progress shared by the links _Serve drives. */
+typedef struct SERVE_s * SERVE_t;
+struct SERVE_s {
+    size_t ncmds;	/* commands per link */
+    size_t nactive;
+    size_t nfailed;
+};
+
+/* A link's command completed: submit its next one, or retire the link. */
+static void _Next(IO_t io, void *arg, int rc, uint16_t retval)
+{
+    SERVE_t sv = arg;
+
+    if (rc) {
+	sv->nactive--;
+	sv->nfailed++;
+    } else if (++io->ncmds >= sv->ncmds)
+	sv->nactive--;
+    else	/* TID_PRES is RDONLY, no sensor side effects */
+	(void) _Submit(io, TID_PRES, io->ncmds % _CMD_NDEVS, NULL, 0, _Next, sv);
+}
+
+/*
+ * Drive n links from one event loop. Each link keeps one command in
+ * flight, and the response on any link immediately sends that link's
+ * next command, so slow devices do not hold up the others. A link whose
+ * response is overdue gets its command resent, up to maxretrys times.
+ */
+static int _Serve(IO_t *ios, size_t n, size_t ncmds, size_t *nfailedp)
+{
+    LOOP_t loop = NULL;
+    struct epoll_event ev[16];
+    uint64_t now, tscan;
+    struct SERVE_s sv = { .ncmds = ncmds };
+    long tick = 100000;		/* usecs between overdue scans: the least RTO */
+    int rc = -1;	/* assume failure */
+
+    for (size_t i = 0; i < n; i++) {
+	IO_t io = ios[i];
+	loop = _LoopGet(io);
+	io->ncmds = 0;
+	if (ncmds > 0) {
+	    sv.nactive++;
+	    (void) _Submit(io, TID_PRES, 0, NULL, 0, _Next, &sv);
+	}
+    }
+    tscan = _Now();
+
+    while (sv.nactive > 0 && !exit_request) {
+	int nev = check(ios[0], "==> epoll_wait", NULL,
+		epoll_wait(loop->epfd, ev, sizeof(ev)/sizeof(ev[0]),
+			(int)((tick + 999) / 1000)));
+	if (nev < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("epoll_wait");
+	    goto exit;
+	}
+
+	for (int i = 0; i < nev; i++) {
+	    void * ptr = ev[i].data.ptr;
+	    IO_t io = ptr;
+
+	    if (ptr == &loop->sigfd) {
+		struct signalfd_siginfo ssi;
+		while (read(loop->sigfd, &ssi, sizeof(ssi)) == sizeof(ssi))
+		    exit_request = 1;
+		continue;
+	    }
+	    if (ptr == &loop->tmfd)
+		continue;
+
+	    if (_Drain(io) <= 0) {	/* EOF or error */
+		_Abort(io);
+		continue;
+	    }
+	    while (io->waitq.head && _DecGet(&io->dec, io->msgfmt, &io->riov))
+		(void) _Complete(io);
+	    _Unpark(io);
+	}
+
+	/* Resend the command in flight on links whose response is overdue. */
+	now = _Now();
+	if ((int64_t)(now - tscan) < 1000LL * tick)
+	    continue;
+	tscan = now;
+	tick = 100000;
+	for (size_t i = 0; i < n; i++) {
+	    IO_t io = ios[i];
+	    if (io->waitq.head == NULL)
+		continue;
+	    if (tick > _Wait(io))
+		tick = _Wait(io);
+	    (void) _Expire(io, now);
+	}
+    }
+    rc = 0;
+
+exit:
+    for (size_t i = 0; i < n; i++)
+	_Abort(ios[i]);
+    if (nfailedp)
+	*nfailedp = sv.nfailed;
+fprintf(stderr, "<== %s: rc %d active %zu failed %zu\n", __FUNCTION__, rc, sv.nactive, sv.nfailed);
+    return rc;
+}
+
+#if defined(WITH_PTHREADS)
+static void * _Emulator(void * arg)
+{
+    IO_t io = arg;
+    return (void *)(intptr_t) _Child(io);
+}
+#endif
+
+/*
+ * Controller mode: start ndevs AVR emulators, each on its own link with
+ * its own device state, and drive 1, 2, 4, ... ndevs of them at once
+ * from one event loop, reporting aggregate commands per second. The
+ * emulators are forked processes, or threads in this process (--threads).
+ */
+static int _Controller(size_t ndevs)
+{
+    static struct MSG_s quit = { .tid = TID_GLOBAL, .cmd = CMD_QUIT };
+    size_t ncmds = (_cmd_bench > 0 ? _cmd_bench : 1000);
+    IO_t *ios = xcalloc(ndevs, sizeof(*ios));
+    pid_t *pids = xcalloc(ndevs, sizeof(*pids));
+#if defined(WITH_PTHREADS)
+    IO_t *avrs = xcalloc(ndevs, sizeof(*avrs));
+    pthread_t *tids = xcalloc(ndevs, sizeof(*tids));
+    pthread_attr_t attr;
+#endif
+    struct rlimit rl;
+    int rc = 0;
+
+    /* Each link needs 2 descriptors (plus 1 more per forked emulator). */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+	rl.rlim_cur = rl.rlim_max;
+	(void) setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#if defined(WITH_PTHREADS)
+    (void) pthread_attr_init(&attr);
+    (void) pthread_attr_setstacksize(&attr, 256 * 1024);
+#endif
+
+    for (size_t n = 1; n <= ndevs && !exit_request; n = (n < ndevs && 2*n > ndevs ? ndevs : 2*n)) {
+	struct timeval t0, t1;
+	size_t nopen = 0;
+	size_t nfailed = 0;
+	size_t nresend;
+	long rtomax;
+	double dt;
+
+	for (size_t i = 0; i < n; i++) {
+	    URG_t urg = _UrgDup(&_urg);
+	    IO_t io = newIO(_Socketpair, urg);
+	    if (io->sv[0] < 0) {
+		free(io);
+		urg = _UrgFree(urg);
+		break;
+	    }
+#if defined(WITH_PTHREADS)
+	    if (_io_threads) {
+		IO_t avr = memcpy(xmalloc(sizeof(*io)), io, sizeof(*io));
+		avr->role = "avr";	/* XXX */
+		avr->fdno = io->sv[1];	/* XXX */
+		/* The epoll loop is per process: emulators use pselect. */
+		if (avr->Chk == _Epoll)
+		    avr->Chk = _Poll;
+		io->role = "nuc";	/* XXX */
+		io->fdno = io->sv[0];	/* XXX */
+		if ((errno = pthread_create(tids + i, &attr, _Emulator, avr))) {
+		    perror("pthread_create");
+		    (void) close(io->sv[0]);
+		    (void) close(io->sv[1]);
+		    free(avr);
+		    free(io);
+		    urg = _UrgFree(urg);
+		    break;
+		}
+		avrs[i] = avr;
+		ios[nopen++] = io;
+		continue;
+	    }
+#endif
+	    switch ((pids[i] = fork())) {
+	    case -1:
+		perror("fork");
+		(void) close(io->sv[0]);
+		(void) close(io->sv[1]);
+		free(io);
+		urg = _UrgFree(urg);
+		break;
+	    case 0:
+		_TraceOpen();
+		io->role = "avr";	/* XXX */
+		io->fdno = io->sv[1];	/* XXX */
+		(void) close(io->sv[0]);
+		rc = _Child(io);
+		exit(rc);
+		break;
+	    default:
+		io->role = "nuc";	/* XXX */
+		io->fdno = io->sv[0];	/* XXX */
+		(void) close(io->sv[1]);
+		ios[nopen++] = io;
+		break;
+	    }
+	    if (pids[i] < 0)
+		break;
+	}
+
+	(void) tstamp(&t0);
+	rc = _Serve(ios, nopen, ncmds, &nfailed);
+	(void) tstamp(&t1);
+	dt = _Elapsed(&t0, &t1);
+fprintf(stderr, "*** %s: %4zu devices: %zu cmds/device %.0f cmd/s aggregate, %.0f cmd/s/device, %zu failed\n", __FUNCTION__, nopen, ncmds, nopen * ncmds / dt, ncmds / dt, nfailed);
+
+	nresend = 0;
+	rtomax = 0;
+	for (size_t i = 0; i < nopen; i++) {
+	    nresend += ios[i]->nresend;
+	    if (rtomax < _Wait(ios[i]))
+		rtomax = _Wait(ios[i]);
+	}
+fprintf(stderr, "*** %s: %4zu devices: %zu resent, max rto %ld usecs\n", __FUNCTION__, nopen, nresend, rtomax);
+	if (_io_stats)
+	    (void) _StatsJSON(ios, nopen, stdout);
+
+	for (size_t i = 0; i < nopen; i++) {
+	    IO_t io = ios[i];
+	    (void) _Post(io, &quit, io->nextseq++);
+#if defined(WITH_PTHREADS)
+	    if (_io_threads) {
+		(void) pthread_join(tids[i], NULL);
+		(void) close(io->sv[1]);
+		free(avrs[i]);
+		avrs[i] = NULL;
+	    } else
+#endif
+	    (void) waitpid(pids[i], NULL, 0);
+	    if (io->loop)
+		(void) epoll_ctl(io->loop->epfd, EPOLL_CTL_DEL, io->fdno, NULL);
+	    (void) io->Close(io);
+	    io->urg = _UrgFree(io->urg);
+	    free(io);
+	    ios[i] = NULL;
+	}
+	if (rc)
+	    break;
+	if (n == ndevs)
+	    break;
+    }
+
+#if defined(WITH_PTHREADS)
+    (void) pthread_attr_destroy(&attr);
+    free(tids);
+    free(avrs);
+#endif
+    free(pids);
+    free(ios);
+    return rc;
+}
+#endif	/* linux */
+
 static int _Doit(rpmmqtt mqtt)
 {
-    IO_t pio = newIO(_Socketpair);
-    int rc = _Fork(pio);
+    int (*Open) (IO_t io);
+    IO_t pio = NULL;
+    int rc = -1;
+
+#if defined(linux)
+    if (_io_ndevs > 0) {
+	rc = _Controller(_io_ndevs);
+	goto exit;
+    }
+#endif
+    Open = (_io_tty ? _Serial : (_io_pty ? _Pty : _Socketpair));
+#if defined(linux) && defined(__NR_memfd_create) && defined(__NR_futex)
+    if (_io_shm && Open == _Socketpair)
+	Open = _Shm;
+#endif
+    pio = newIO(Open, &_urg);
+    if (pio->sv[0] < 0)
+	goto exit;
+    if (pio->sv[1] < 0) {	/* no local peer: talk to the device */
+	pio->role = "nuc";	/* XXX */
+	pio->fdno = pio->sv[0];	/* XXX */
+	rc = _Parent(pio);
+    } else
+	rc = _Fork(pio);
+
+exit:
     free(pio);
     return rc;
 }
 
 /*==============================================================*/
 
-static void _PrintCSVT(CSV_t csv, FILE *fp)
+static void _PrintCSVT(CSV_t csv, void * base, FILE *fp)
 {
+    CSVptr_t attr;
+
+    attr._ptr = (char *)base + csv->off;
     fprintf(stderr, "%12s %32s:", CSVtypestr[csv->type%CSVT_LAST], csv->sN);
 
     switch(csv->type) {
@@ -1759,10 +5789,10 @@ static void _PrintCSVT(CSV_t csv, FILE *fp)
     case CSVT_check:
     case CSVT_ignore:
     default:
-	fprintf(stderr, " %p", csv->attr._ptr);
+	fprintf(stderr, " %p", attr._ptr);
 	break;
     case CSVT_string:
-      { const char * val = (const char *)csv->attr.string;
+      { const char * val = (const char *)attr.string;
 	fprintf(stderr, " %s", val);
       } break;
     case CSVT_real:
@@ -1771,13 +5801,13 @@ static void _PrintCSVT(CSV_t csv, FILE *fp)
 	default:
 	case 0:
 fprintf(stderr, "XXX FIXME: double alignment\n");
-	    d = *(double *)csv->attr._ptr;
+	    d = *(double *)attr._ptr;
 	    break;
 	case sizeof(float):
-	    d = *csv->attr._fp;
+	    d = *attr._fp;
 	    break;
 	case sizeof(double):
-	    d = *csv->attr._dp;
+	    d = *attr._dp;
 	    break;
 	}
 	fprintf(stderr, " %g", d);
@@ -1788,19 +5818,19 @@ fprintf(stderr, "XXX FIXME: double alignment\n");
 	default:
 	case 0:
 fprintf(stderr, "XXX FIXME: int alignment\n");
-	    i64 = *(int *)csv->attr._ptr;
+	    i64 = *(int *)attr._ptr;
 	    break;
 	case sizeof(int8_t):
-	    i64 = *csv->attr._i8p;
+	    i64 = *attr._i8p;
 	    break;
 	case sizeof(int16_t):
-	    i64 = *csv->attr._i16p;
+	    i64 = *attr._i16p;
 	    break;
 	case sizeof(int32_t):
-	    i64 = *csv->attr._i32p;
+	    i64 = *attr._i32p;
 	    break;
 	case sizeof(int64_t):
-	    i64 = *csv->attr._i64p;
+	    i64 = *attr._i64p;
 	    break;
 	}
 	fprintf(stderr, " %lld", i64);
@@ -1811,29 +5841,29 @@ fprintf(stderr, "XXX FIXME: int alignment\n");
 	default:
 	case 0:
 fprintf(stderr, "XXX FIXME: unsigned alignment\n");
-	    ui64 = *(unsigned *)csv->attr._ptr;
+	    ui64 = *(unsigned *)attr._ptr;
 	    break;
 	case sizeof(uint8_t):
-	    ui64 = *csv->attr._ui8p;
+	    ui64 = *attr._ui8p;
 	    break;
 	case sizeof(uint16_t):
-	    ui64 = *csv->attr._ui16p;
+	    ui64 = *attr._ui16p;
 	    break;
 	case sizeof(uint32_t):
-	    ui64 = *csv->attr._ui32p;
+	    ui64 = *attr._ui32p;
 	    break;
 	case sizeof(uint64_t):
-	    ui64 = *csv->attr._ui64p;
+	    ui64 = *attr._ui64p;
 	    break;
 	}
 	fprintf(stderr, " %llu", ui64);
       } break;
     case CSVT_FLOAT:
-      { FLOAT_t val = *(FLOAT_t *)csv->attr._ptr;
+      { FLOAT_t val = *(FLOAT_t *)attr._ptr;
 	fprintf(stderr, " %10.3f", _I2F(val));
       } break;
     case CSVT_TSTAMP:
-      {	TSTAMP_t *tvp = (TSTAMP_t *)csv->attr._ptr;
+      {	TSTAMP_t *tvp = (TSTAMP_t *)attr._ptr;
 	static const char _fmt[] = " %Y-%m-%d %H:%M:%S";
 	static char b[MSGBUFLEN];
 	size_t nb = sizeof(b);
@@ -1844,7 +5874,7 @@ fprintf(stderr, "XXX FIXME: unsigned alignment\n");
 	fprintf(stderr, " %s", b);
       } break;
     case CSVT_TDIFF:
-      {	TDIFF_t *tvp = (TDIFF_t *)csv->attr._ptr;
+      {	TDIFF_t *tvp = (TDIFF_t *)attr._ptr;
 	static const char _fmt[] = "            %H:%M:%S";
 	static char b[MSGBUFLEN];
 	size_t nb = sizeof(b);
@@ -1858,11 +5888,12 @@ fprintf(stderr, "XXX FIXME: unsigned alignment\n");
     fprintf(stderr, "\n");
 }
 
-static void _PrintSENSOR(const char *msg, struct SENSOR_s * sensor, FILE *fp)
+static void _PrintSENSOR(URG_t urg, const char *msg, struct SENSOR_s * sensor, FILE *fp)
 {
 #define	_ENTRY(_t, _sN, _dN) \
-	{ #_sN, CSVT_##_t, {&sensor->_sN}, {#_dN}, sizeof(sensor->_sN)}
-    struct CSV_s csvSENSOR[] = {	/* #3 */
+	{ #_sN, CSVT_##_t, offsetof(struct SENSOR_s, _sN), {#_dN}, \
+		sizeof(((struct SENSOR_s *)0)->_sN)}
+    static struct CSV_s csvSENSOR[] = {	/* #3 */
 	_ENTRY(TSTAMP,   tstamp,	"Date and Time"),
 	_ENTRY(string,   name,		"Sensor"),
 	_ENTRY(uinteger, pts,		"Points"),
@@ -1892,15 +5923,16 @@ static void _PrintSENSOR(const char *msg, struct SENSOR_s * sensor, FILE *fp)
 
     sensor->rval = (sensor->avg - sensor->off)/sensor->gain;
     for (size_t i = 0; i < ncsvSENSOR; i++) {
-	_PrintCSVT(csvSENSOR+i, fp);
+	_PrintCSVT(csvSENSOR+i, sensor, fp);
     }
 }
 
 static void _PrintSTATS(const char *msg, struct SENSOR_s * sensor, FILE *fp)
 {
 #define _ENTRY(_t, _sN, _dN) \
-	{ #_sN, CSVT_##_t, {&sensor->_sN}, {#_dN}, sizeof(sensor->_sN)}
-    struct CSV_s csvSTATS[] = {	/* #3 */
+	{ #_sN, CSVT_##_t, offsetof(struct SENSOR_s, _sN), {#_dN}, \
+		sizeof(((struct SENSOR_s *)0)->_sN)}
+    static struct CSV_s csvSTATS[] = {	/* #3 */
 	_ENTRY(FLOAT,  avg,		"Average Ambient"),
 	_ENTRY(FLOAT,  max,		"Maximum Ambient"),
 	_ENTRY(FLOAT,  min,		"Minimum Ambient"),
@@ -1909,15 +5941,16 @@ static void _PrintSTATS(const char *msg, struct SENSOR_s * sensor, FILE *fp)
     size_t ncsvSTATS = (sizeof(csvSTATS)/sizeof(csvSTATS[0]));
     fprintf(fp, "============ %s\n", msg);
     for (size_t i = 0; i < ncsvSTATS; i++) {
-	_PrintCSVT(csvSTATS+i, fp);
+	_PrintCSVT(csvSTATS+i, sensor, fp);
     }
 }
 
 static void _PrintQC(const char *msg, struct SENSOR_s * sensor, FILE *fp)
 {
 #define _ENTRY(_t, _sN, _dN) \
-	{ #_sN, CSVT_##_t, {&sensor->_sN}, {#_dN}, sizeof(sensor->_sN)}
-    struct CSV_s csvQC[] = {	/* #3 */
+	{ #_sN, CSVT_##_t, offsetof(struct SENSOR_s, _sN), {#_dN}, \
+		sizeof(((struct SENSOR_s *)0)->_sN)}
+    static struct CSV_s csvQC[] = {	/* #3 */
 	_ENTRY(TSTAMP, tstamp,		"Date and Time"),
 	_ENTRY(string, name,		"QC Item"),
 	_ENTRY(FLOAT,  sys,		"System Value"),
@@ -1927,69 +5960,71 @@ static void _PrintQC(const char *msg, struct SENSOR_s * sensor, FILE *fp)
     size_t ncsvQC = (sizeof(csvQC)/sizeof(csvQC[0]));
     fprintf(fp, "============ %s\n", msg);
     for (size_t i = 0; i < ncsvQC; i++) {
-	_PrintCSVT(csvQC+i, fp);
+	_PrintCSVT(csvQC+i, sensor, fp);
     }
 }
 
-static void _PrintTABLE(const char * msg, CSV_t csvTABLE, size_t ncsvTABLE, FILE *fp)
+static void _PrintTABLE(URG_t urg, const char * msg, CSV_t csvTABLE, size_t ncsvTABLE, FILE *fp)
 {
     fprintf(fp, "============ %s\n", msg);
     for (size_t i = 0; i < ncsvTABLE; i++)
-	_PrintCSVT(csvTABLE+i, fp);
+	_PrintCSVT(csvTABLE+i, urg, fp);
 }
 
-static void _PrintALL(FILE *fp)
+static void _PrintALL(URG_t urg, FILE *fp)
 {
+    _SensorStats(urg);
+
 #ifdef	NOTYET
-    _PrintTABLE("EVENT",	csvEVENT, ncsvEVENT, fp);
-    _PrintTABLE("DATA",		csvDATA, ncsvDATA, fp);
+    _PrintTABLE(urg, "EVENT",	csvEVENT, ncsvEVENT, fp);
+    _PrintTABLE(urg, "DATA",		csvDATA, ncsvDATA, fp);
 
-    _PrintTABLE("CALIBRATION",	csvCALIBRATION, ncsvCALIBRATION, fp);
+    _PrintTABLE(urg, "CALIBRATION",	csvCALIBRATION, ncsvCALIBRATION, fp);
 #endif
 
-    _PrintSENSOR("SENSOR",	&_urg.ambient, fp);
+    _PrintSENSOR(urg, "SENSOR",	&urg->ambient, fp);
 #ifdef	NOTYET
-    _PrintSENSOR("SENSOR",	&_urg.filter, fp);
-    _PrintSENSOR("SENSOR",	&_urg.meter, fp);
-    _PrintSENSOR("SENSOR",	&_urg.inactive, fp);
+    _PrintSENSOR(urg, "SENSOR",	&urg->filter, fp);
+    _PrintSENSOR(urg, "SENSOR",	&urg->meter, fp);
+    _PrintSENSOR(urg, "SENSOR",	&urg->inactive, fp);
 #endif
-    _PrintSENSOR("SENSOR",	&_urg.barometer, fp);
+    _PrintSENSOR(urg, "SENSOR",	&urg->barometer, fp);
 #ifdef	NOTYET
-    _PrintSENSOR("SENSOR",	&_urg.meter_drop, fp);
-    _PrintSENSOR("SENSOR",	&_urg.flow_sensor, fp);
+    _PrintSENSOR(urg, "SENSOR",	&urg->meter_drop, fp);
+    _PrintSENSOR(urg, "SENSOR",	&urg->flow_sensor, fp);
 #endif
 
-    _PrintSTATS("Ambient",	&_urg.ambient, fp);
+    _PrintSTATS("Ambient",	&urg->ambient, fp);
 #ifdef	NOTYET
-    _PrintSTATS("Filter",	&_urg.filter, fp);
-    _PrintSTATS("Meter",	&_urg.meter, fp);
-    _PrintSTATS("Inactive",	&_urg.inactive, fp);
+    _PrintSTATS("Filter",	&urg->filter, fp);
+    _PrintSTATS("Meter",	&urg->meter, fp);
+    _PrintSTATS("Inactive",	&urg->inactive, fp);
 #endif
-    _PrintSTATS("Barometer",	&_urg.barometer, fp);
+    _PrintSTATS("Barometer",	&urg->barometer, fp);
 #ifdef	NOTYET
-    _PrintSTATS("MeterDrop",	&_urg.meter_drop, fp);
-    _PrintSTATS("FlowSensor",	&_urg.flow_sensor, fp);
+    _PrintSTATS("MeterDrop",	&urg->meter_drop, fp);
+    _PrintSTATS("FlowSensor",	&urg->flow_sensor, fp);
 #endif
 
 #ifdef	NOTYET
-    _PrintTABLE("QC",		csvQC, ncsvQC, fp);
+    _PrintTABLE(urg, "QC",		csvQC, ncsvQC, fp);
 #endif
 
-    _PrintQC("Ambient",		&_urg.ambient, fp);
+    _PrintQC("Ambient",		&urg->ambient, fp);
 #ifdef	NOTYET
-    _PrintQC("Filter",		&_urg.filter, fp);
-    _PrintQC("Meter",		&_urg.meter, fp);
-    _PrintQC("Inactive",	&_urg.inactive, fp);
+    _PrintQC("Filter",		&urg->filter, fp);
+    _PrintQC("Meter",		&urg->meter, fp);
+    _PrintQC("Inactive",	&urg->inactive, fp);
 #endif
-    _PrintQC("Barometer",	&_urg.barometer, fp);
+    _PrintQC("Barometer",	&urg->barometer, fp);
 #ifdef	NOTYET
-    _PrintQC("MeterDrop",	&_urg.meter_drop, fp);
-    _PrintQC("FlowSensor",	&_urg.flow_sensor, fp);
+    _PrintQC("MeterDrop",	&urg->meter_drop, fp);
+    _PrintQC("FlowSensor",	&urg->flow_sensor, fp);
 
-    _PrintTABLE("POWERFAIL",	csvPOWERFAIL, ncsvPOWERFAIL, fp);
-    _PrintTABLE("DEBUG",	csvDEBUG, ncsvDEBUG, fp);
+    _PrintTABLE(urg, "POWERFAIL",	csvPOWERFAIL, ncsvPOWERFAIL, fp);
+    _PrintTABLE(urg, "DEBUG",	csvDEBUG, ncsvDEBUG, fp);
 #endif
-    _PrintTABLE("SITE",		csvSITE, ncsvSITE, fp);
+    _PrintTABLE(urg, "SITE",		csvSITE, ncsvSITE, fp);
 }
 
 /*==============================================================*/
@@ -3136,7 +7171,7 @@ fprintf(stderr, "\t|%s|\n", b);
 static int _DoJSON(rpmmqtt mqtt)
 {
     int status = 0;
-    _PrintALL(stderr);
+    _PrintALL(&_urg, stderr);
     for (int i = 1; i <= MAXTEST; i++) {
 fprintf(stderr, "======== test %d\n", i);
 	jsontest(i);
@@ -3150,8 +7185,64 @@ static void hdl (int sig)
     exit_request = 1;
 }
 
+static int _crc_bench;
+static int _bank_bench;
+
 static struct poptOption optionsTable[] = {
 
+ { "crcbench", '\0', POPT_ARG_VAL,	&_crc_bench, 1,
+	N_("Verify and benchmark the CRC-16/X25 engines"), NULL },
+ { "bankbench", '\0', POPT_ARG_INT,	&_bank_bench, 0,
+	N_("Verify and time the A2D sweep kernels over N sweeps"), N_("N") },
+ { "epoll", '\0', POPT_ARG_VAL,	&_io_epoll, 1,
+	N_("Use the epoll event loop instead of pselect"), NULL },
+ { "uring", '\0', POPT_ARG_VAL,	&_io_uring, 1,
+	N_("Use io_uring for sends and receives"), NULL },
+ { "timeout", '\0', POPT_ARG_INT,	&_io_timeout, 0,
+	N_("Wait up to MSECS for each response (default 1000)"), N_("MSECS") },
+ { "tty", '\0', POPT_ARG_STRING,	&_io_tty, 0,
+	N_("Talk to the AVR on serial DEVICE"), N_("DEVICE") },
+ { "pty", '\0', POPT_ARG_VAL,	&_io_pty, 1,
+	N_("Run the AVR emulator across a pty pair"), NULL },
+ { "lowlatency", '\0', POPT_ARG_VAL,	&_io_lowlatency, 1,
+	N_("Request low latency mode from the serial driver"), NULL },
+ { "devices", '\0', POPT_ARG_INT,	&_io_ndevs, 0,
+	N_("Drive N emulated AVRs from one event loop"), N_("N") },
+ { "delay", '\0', POPT_ARG_INT,	&_emu_delay, 0,
+	N_("Emulated AVRs wait USECS before responding"), N_("USECS") },
+ { "jitter", '\0', POPT_ARG_INT,	&_emu_jitter, 0,
+	N_("Emulated AVRs wait up to USECS more at random"), N_("USECS") },
+ { "drop", '\0', POPT_ARG_INT,	&_emu_drop, 0,
+	N_("Emulated AVRs lose PCT% of responses"), N_("PCT") },
+ { "corrupt", '\0', POPT_ARG_INT,	&_emu_corrupt, 0,
+	N_("Emulated AVRs corrupt PCT% of responses"), N_("PCT") },
+#if defined(WITH_PTHREADS)
+ { "threads", '\0', POPT_ARG_VAL,	&_io_threads, 1,
+	N_("Run the --devices emulators as threads"), NULL },
+#endif
+ { "shm", '\0', POPT_ARG_VAL,	&_io_shm, 1,
+	N_("Link the AVR emulator through shared memory rings"), NULL },
+ { "window", '\0', POPT_ARG_INT,	&_io_window, 0,
+	N_("Keep N commands in flight (adds a sequence byte)"), N_("N") },
+ { "cmdbench", '\0', POPT_ARG_INT,	&_cmd_bench, 0,
+	N_("Time N commands stop-and-wait vs. pipelined"), N_("N") },
+ { "push", '\0', POPT_ARG_INT,	&_push_msecs, 0,
+	N_("Stream the A2D sensors pushed every MSECS"), N_("MSECS") },
+ { "iodebug", '\0', POPT_ARG_INT,	&_io_debug, 0,
+	N_("Debug output: 1 per message (default), -1 every check, 0 errors only"), N_("N") },
+ { "stats", '\0', POPT_ARG_VAL,	&_io_stats, 1,
+	N_("Print protocol counters and latency histograms as JSON"), NULL },
+ { "trace", '\0', POPT_ARG_STRING,	&_io_trace, 0,
+	N_("Trace to memory, dump to FILE.<pid> at exit or on SIGUSR1"), N_("FILE") },
+ { "decode", '\0', POPT_ARG_STRING,	&_io_decode, 0,
+	N_("Print a dumped trace FILE as text"), N_("FILE") },
+ { "capture", '\0', POPT_ARG_STRING,	&_io_capture, 0,
+	N_("Append every read and write on the links to FILE"), N_("FILE") },
+ { "replay", '\0', POPT_ARG_STRING,	&_io_replay, 0,
+	N_("Feed the bytes received in capture FILE to _Parse and _Process"), N_("FILE") },
+ { "pace", '\0', POPT_ARG_VAL,	&_replay_pace, 1,
+	N_("Replay at the recorded pace instead of flat out"), NULL },
+
  { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmioAllPoptTable, 0,
 	N_("Common options for all rpmio executables:"),
 	NULL },
@@ -3186,11 +7277,43 @@ main(int argc, char *argv[])
 	goto exit;
     }
 
+    pppfcs_init();
+    _BankSweepInit();
+
+    if (_crc_bench) {
+	rc = _DoCRC(mqtt);
+	goto exit;
+    }
+    if (_bank_bench > 0) {
+	rc = _DoBank(_bank_bench);
+	goto exit;
+    }
+
+    if (_io_decode) {
+	rc = _TraceDecode(_io_decode);
+	goto exit;
+    }
+    if (_io_replay) {
+	rc = _Replay(_io_replay);
+	goto exit;
+    }
+    if (_io_capture && _CaptureOpen(_io_capture))
+	goto exit;
+    if (_io_trace) {
+	_TraceOpen();
+	(void) atexit(_TraceDump);
+	(void) signal(SIGUSR1, _TraceSignal);
+	(void) signal(SIGSEGV, _TraceSignal);
+	(void) signal(SIGBUS, _TraceSignal);
+	(void) signal(SIGABRT, _TraceSignal);
+    }
+
     rc = _Doit(mqtt);
 
     rc = _DoJSON(mqtt);
 
 exit:
+    (void) _UrgFree(&_urg);
     mqtt = rpmmqttFree(mqtt);
     optCon = rpmioFini(optCon);
     return rc;